@@ -8,6 +8,7 @@ CoreProcess::CoreProcess(Elf::Object::sptr exec, Elf::Object::sptr core,
         const PathReplacementList &pathReplacements_, Dwarf::ImageCache &imageCache)
     : Process(std::move(exec), std::make_shared<CoreReader>(this), pathReplacements_, imageCache)
     , coreImage(std::move(core))
+    , regsLoaded(false)
 {
 }
 
@@ -115,18 +116,25 @@ CoreReader::CoreReader(CoreProcess *p_) : p(p_) { }
 bool
 CoreProcess::getRegs(lwpid_t pid, Elf::CoreRegisters *reg)
 {
-#ifdef NT_PRSTATUS
-   for (auto note : coreImage->notes) {
-        if (note.name() == "CORE" && note.type() == NT_PRSTATUS) {
-            const auto &prstatus = note.data()->readObj<prstatus_t>(0);
-            if (prstatus.pr_pid == pid) {
-                memcpy(reg, &prstatus.pr_reg, sizeof(*reg));
-                return true;
-            }
-        }
-   }
-#endif
-   return false;
+    if (!regsLoaded)
+        findLWPs();
+    auto it = lwps.find(pid);
+    if (it == lwps.end() || !it->second.regsValid)
+        return false;
+    *reg = it->second.regs;
+    return true;
+}
+
+bool
+CoreProcess::getFPRegs(lwpid_t pid, Elf::CoreFPRegisters *reg)
+{
+    if (!regsLoaded)
+        findLWPs();
+    auto it = lwps.find(pid);
+    if (it == lwps.end() || !it->second.fpregsValid)
+        return false;
+    *reg = it->second.fpregs;
+    return true;
 }
 
 void
@@ -148,6 +156,13 @@ CoreProcess::stopProcess()
     findLWPs();
 }
 
+Elf::Addr
+CoreProcess::mappingEnd(Elf::Addr addr)
+{
+    auto hdr = coreImage->getSegmentForAddress(addr);
+    return hdr != nullptr ? hdr->p_vaddr + hdr->p_memsz : 0;
+}
+
 pid_t
 CoreProcess::getPID() const
 {
@@ -158,11 +173,34 @@ CoreProcess::getPID() const
     return -1;
 }
 
+/*
+ * Each LWP has an NT_PRSTATUS note, followed by its other register notes, so
+ * we can find all the LWPs and their registers in a single pass.
+ */
 void
 CoreProcess::findLWPs()
 {
+    if (regsLoaded)
+        return;
+    regsLoaded = true;
+    Lwp *current = nullptr;
     for (auto note : coreImage->notes) {
-        if (note.name() == "CORE" && note.type() == NT_PRSTATUS)
-            (void)lwps[note.data()->readObj<prstatus_t>(0).pr_pid];
+        if (note.name() != "CORE")
+            continue;
+        switch (note.type()) {
+            case NT_PRSTATUS: {
+                const auto &prstatus = note.data()->readObj<prstatus_t>(0);
+                current = &lwps[prstatus.pr_pid];
+                memcpy(&current->regs, &prstatus.pr_reg, sizeof current->regs);
+                current->regsValid = true;
+                break;
+            }
+            case NT_FPREGSET:
+                if (current != nullptr && note.data()->size() >= off_t(sizeof current->fpregs)) {
+                    note.data()->readObj(0, &current->fpregs);
+                    current->fpregsValid = true;
+                }
+                break;
+        }
     }
 }
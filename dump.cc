@@ -209,13 +209,42 @@ std::ostream &operator << (std::ostream &os, const JSON<Dwarf::FileEntry> &jobj)
         .field("lastmod", fe.lastMod);
 }
 
-template <typename C>
-std::ostream &operator << (std::ostream &os, const JSON<Dwarf::LineState, C> &jo) {
-    auto &ls = jo.object;
-    return JObject(os)
-        .field("file", *ls.file)
-        .field("line", ls.line)
-        .field("addr", ls.addr);
+/*
+ * Reconstitutes the line number matrix from the sequences of a LineInfo.
+ */
+struct LineMatrix {
+    const Dwarf::LineInfo &lines;
+    explicit LineMatrix(const Dwarf::LineInfo &lines_) : lines(lines_) {}
+};
+
+static void
+dumpLineRow(std::ostream &os, const Dwarf::LineInfo &lines, unsigned file,
+        unsigned line, uintmax_t addr)
+{
+    JObject(os)
+        .field("file", file < lines.files.size() ? lines.files[file] : Dwarf::FileEntry())
+        .field("line", line)
+        .field("addr", addr);
+}
+
+std::ostream &operator << (std::ostream &os, const JSON<LineMatrix> &jo) {
+    auto &lines = jo.object.lines;
+    os << "[ ";
+    std::string sep;
+    for (const auto &seq : lines.sequences) {
+        for (auto i = seq.firstRow; i < seq.lastRow; ++i) {
+            const auto &row = lines.rows[i];
+            os << sep;
+            dumpLineRow(os, lines, row.file, row.line, seq.start + row.addr);
+            sep = ",\n";
+        }
+        if (seq.endSequence) {
+            os << sep;
+            dumpLineRow(os, lines, seq.endFile, seq.endLine, seq.end);
+            sep = ",\n";
+        }
+    }
+    return os << "]";
 }
 
 template <typename C>
@@ -227,7 +256,7 @@ std::ostream &operator << (std::ostream &os, const JSON<Dwarf::LineInfo, C> &jo)
         .field("opcode_lengths", lines.opcode_lengths)
         .field("files", lines.files)
         .field("directories", lines.directories)
-        .field("matrix", lines.matrix);
+        .field("matrix", LineMatrix(lines));
 }
 
 template <typename C>
@@ -372,6 +401,11 @@ operator << (std::ostream &os, const JSON<Dwarf::Attribute> &o)
     writer.field("form", attr.form());
     switch (attr.form()) {
     case DW_FORM_addr:
+    case DW_FORM_addrx:
+    case DW_FORM_addrx1:
+    case DW_FORM_addrx2:
+    case DW_FORM_addrx3:
+    case DW_FORM_addrx4:
     case DW_FORM_data1:
     case DW_FORM_data2:
     case DW_FORM_data4:
@@ -381,11 +415,19 @@ operator << (std::ostream &os, const JSON<Dwarf::Attribute> &o)
         writer.field("value", uintmax_t(attr));
         break;
     case DW_FORM_sdata:
+    case DW_FORM_implicit_const:
         writer.field("value", intmax_t(attr));
         break;
     case DW_FORM_GNU_strp_alt:
+    case DW_FORM_strp_sup:
     case DW_FORM_string:
     case DW_FORM_strp:
+    case DW_FORM_line_strp:
+    case DW_FORM_strx:
+    case DW_FORM_strx1:
+    case DW_FORM_strx2:
+    case DW_FORM_strx3:
+    case DW_FORM_strx4:
         writer.field("value", std::string(attr));
         break;
 
@@ -393,6 +435,8 @@ operator << (std::ostream &os, const JSON<Dwarf::Attribute> &o)
     case DW_FORM_ref2:
     case DW_FORM_ref4:
     case DW_FORM_ref8:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_ref_sup8:
     case DW_FORM_GNU_ref_alt:
     case DW_FORM_ref_udata: {
         const auto entry = DIE(attr);
@@ -405,6 +449,7 @@ operator << (std::ostream &os, const JSON<Dwarf::Attribute> &o)
     case DW_FORM_block2:
     case DW_FORM_block4:
     case DW_FORM_block:
+    case DW_FORM_data16:
         writer.field("value", Dwarf::Block(attr));
         break;
 
@@ -457,13 +502,35 @@ operator << (std::ostream &os, const JSON<AddrStr> &addr)
    return os << '"' << addr.object.addr << '"';
 }
 
+/*
+ * The FDEs of a CFI, listed in the order they appear in the section.
+ */
+struct FDEList {
+    const std::map<Elf::Off, Dwarf::FDE> &fdes;
+    explicit FDEList(const std::map<Elf::Off, Dwarf::FDE> &fdes_) : fdes(fdes_) {}
+};
+
+std::ostream &
+operator << (std::ostream &os, const JSON<FDEList, const Dwarf::CFI *> &list)
+{
+    os << "[ ";
+    const char *sep = "";
+    for (const auto &fde : list->fdes) {
+        os << sep << json(fde.second, list.context);
+        sep = ",\n";
+    }
+    return os << " ]";
+}
+
 std::ostream &
 operator << (std::ostream &os, const JSON<Dwarf::CFI> &info)
 {
-    Mapper<AddrStr, decltype(info.object.cies)::mapped_type, decltype(info.object.cies)> ciesByString(info.object.cies);
+    info->decodeAll();
+    const auto &cies = info->getCIEs();
+    Mapper<AddrStr, Dwarf::CIE, std::map<Elf::Off, Dwarf::CIE>> ciesByString(cies);
     return JObject(os)
         .field("cielist", ciesByString, &info.object)
-        .field("fdelist", info.object.fdeList, &info.object);
+        .field("fdelist", FDEList(info->getFDEs()), &info.object);
 }
 
 std::ostream &
@@ -473,10 +540,10 @@ operator << (std::ostream &os, const JSON<Dwarf::Info> &di)
     writer.field("units", di->getUnits())
         .field("pubnameUnits", di->pubnames())
         .field("aranges", di->ranges());
-    if (di->debugFrame)
-        writer.field("debugframe", *di->debugFrame);
-    if (di->ehFrame)
-        writer.field("ehFrame", *di->ehFrame);
+    if (di->getDebugFrame())
+        writer.field("debugframe", *di->getDebugFrame());
+    if (di->getEhFrame())
+        writer.field("ehFrame", *di->getEhFrame());
     return writer;
 }
 
@@ -3,6 +3,7 @@
 #include "libpstack/elf.h"
 #include "libpstack/dwarf.h"
 
+#include <cxxabi.h>
 #include <elf.h>
 #include <err.h>
 #include <libgen.h>
@@ -13,32 +14,24 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <set>
 #include <sstream>
 #include <stack>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using std::make_unique;
 using std::make_shared;
 using std::string;
 
 namespace Dwarf {
 
-class RawDIE {
-    RawDIE() = delete;
-    RawDIE(const RawDIE &) = delete;
-    static void readValue(DWARFReader &, Form form, Value &value, const Unit *);
-    Entries children;
-    const Abbreviation *type;
-    std::vector<Value> values;
-public:
-    RawDIE(DWARFReader &, size_t, Unit *);
-    ~RawDIE();
-    friend class Attribute;
-    friend class DIE;
-    friend class DIEAttributes;
-};
+static string formString(const Unit *, Form, const Value &);
 
 uintmax_t
 DWARFReader::getuleb128shift(int *shift, bool &isSigned)
@@ -56,6 +49,43 @@ DWARFReader::getuleb128shift(int *shift, bool &isSigned)
     return result;
 }
 
+/*
+ * Skip over "count" LEB128-encoded values. We read 16 bytes at a time, and
+ * count the bytes with the continuation bit clear, so runs of small values
+ * are skipped without examining each byte individually.
+ */
+void
+DWARFReader::skipleb128(size_t count)
+{
+    unsigned char buf[16];
+    while (count != 0) {
+        size_t avail = std::min(sizeof buf, size_t(end - off));
+        if (avail == 0)
+            throw (Exception() << "LEB128 data overruns end of " << *io);
+        io->readObj(off, buf, avail);
+#ifdef __SSE2__
+        uint32_t ends = ~_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)buf));
+#else
+        uint32_t ends = 0;
+        for (size_t i = 0; i < avail; ++i)
+            if ((buf[i] & 0x80) == 0)
+                ends |= 1U << i;
+#endif
+        ends &= (1U << avail) - 1;
+        size_t found = __builtin_popcount(ends);
+        if (found < count) {
+            count -= found;
+            off += avail;
+            continue;
+        }
+        // Clear the terminators of the first count - 1 values: the lowest
+        // remaining bit terminates the last one.
+        while (--count != 0)
+            ends &= ends - 1;
+        off += __builtin_ctz(ends) + 1;
+    }
+}
+
 Pubname::Pubname(DWARFReader &r, uint32_t offset)
     : offset(offset)
     , name(r.getstring())
@@ -92,28 +122,77 @@ Info::Info(Elf::Object::sptr obj, ImageCache &cache_)
     , debugStrings(sectionReader(*obj, ".debug_str"))
     , abbrev(sectionReader(*obj, ".debug_abbrev"))
     , lineshdr(sectionReader(*obj, ".debug_line"))
+    , lineStrings(sectionReader(*obj, ".debug_line_str"))
+    , strOffsets(sectionReader(*obj, ".debug_str_offsets"))
+    , addrTable(sectionReader(*obj, ".debug_addr"))
+    , rangesh(sectionReader(*obj, ".debug_ranges"))
+    , rnglistsh(sectionReader(*obj, ".debug_rnglists"))
+    , loclistsh(sectionReader(*obj, ".debug_loclists"))
+    , ehFrameLoaded(false)
+    , debugFrameLoaded(false)
+    , functionsIndexed(false)
+    , unitsIndexed(false)
+    , namesLoaded(false)
     , altImageLoaded(false)
     , imageCache(cache_)
     , pubnamesh(sectionReader(*obj, ".debug_pubnames"))
     , arangesh(sectionReader(*obj, ".debug_aranges"))
 {
-    auto f = [this, &obj](const char *name, FIType ftype) {
-        auto &section = obj->getSection(name, SHT_PROGBITS);
-        if (!section)
-            return std::unique_ptr<CFI>();
-
-        try {
-            return make_unique<CFI>(this, section, ftype);
-        }
-        catch (const Exception &ex) {
-            std::clog << "can't decode " << name << " for " << *obj->io << ": " << ex.what() << "\n";
-        }
+}
 
+std::unique_ptr<CFI>
+Info::loadCFI(const char *name, FIType ftype, const Elf::Section &hdr) const
+{
+    auto &section = elf->getSection(name, SHT_PROGBITS);
+    if (!section)
         return std::unique_ptr<CFI>();
-    };
 
-    ehFrame = f(".eh_frame", FI_EH_FRAME);
-    debugFrame = f(".debug_frame", FI_DEBUG_FRAME);
+    try {
+        return make_unique<CFI>(this, section, ftype, hdr);
+    }
+    catch (const Exception &ex) {
+        std::clog << "can't decode " << name << " for " << *elf->io << ": " << ex.what() << "\n";
+    }
+
+    return std::unique_ptr<CFI>();
+}
+
+const CFI *
+Info::getEhFrame() const
+{
+    std::lock_guard<std::mutex> guard(cfiLock);
+    if (!ehFrameLoaded) {
+        ehFrameLoaded = true;
+        ehFrame = loadCFI(".eh_frame", FI_EH_FRAME, elf->getSection(".eh_frame_hdr", SHT_PROGBITS));
+    }
+    return ehFrame.get();
+}
+
+const CFI *
+Info::getDebugFrame() const
+{
+    std::lock_guard<std::mutex> guard(cfiLock);
+    if (!debugFrameLoaded) {
+        debugFrameLoaded = true;
+        debugFrame = loadCFI(".debug_frame", FI_DEBUG_FRAME, Elf::Section());
+    }
+    return debugFrame.get();
+}
+
+const FDE *
+Info::findFDE(Elf::Addr addr, const CFI **cfi) const
+{
+    for (auto get : { &Info::getEhFrame, &Info::getDebugFrame }) {
+        const CFI *frame = (this->*get)();
+        if (frame == nullptr)
+            continue;
+        const FDE *fde = frame->findFDE(addr);
+        if (fde != nullptr) {
+            *cfi = frame;
+            return fde;
+        }
+    }
+    return nullptr;
 }
 
 const std::list<PubnameUnit> &
@@ -129,7 +208,7 @@ Info::pubnames() const
 }
 
 Unit::sptr
-Info::getUnit(off_t offset)
+Info::getUnit(off_t offset) const
 {
     auto unit = unitsm.find(offset);
     if (unit != unitsm.end())
@@ -178,6 +257,34 @@ Info::ranges() const
 
 Info::~Info() = default;
 
+size_t
+Info::memoryUsed()
+{
+    // Allow for the map nodes' pointers and colour.
+    const size_t nodeOverhead = 4 * sizeof (void *);
+    size_t total = sizeof *this
+        + functions.capacity() * sizeof functions[0]
+        + unitRanges.capacity() * sizeof unitRanges[0]
+        + unrangedUnits.capacity() * sizeof unrangedUnits[0]
+        + abbrevTables.size() * nodeOverhead;
+    for (auto &unit : unitsm)
+        total += nodeOverhead + unit.second->memoryUsed();
+    {
+        std::lock_guard<std::mutex> guard(cfiLock);
+        for (auto cfi : { ehFrame.get(), debugFrame.get() })
+            if (cfi != nullptr)
+                total += cfi->memoryUsed();
+    }
+    std::lock_guard<std::mutex> guard(symbolsLock);
+    for (auto &sym : symbolizations) {
+        total += sizeof sym + nodeOverhead
+            + sym.second.symbol.capacity() + sym.second.demangled.capacity();
+        for (auto &source : sym.second.source)
+            total += sizeof source + source.first.capacity();
+    }
+    return total;
+}
+
 ARangeSet::ARangeSet(DWARFReader &r)
 {
     unsigned align, tupleLen;
@@ -209,72 +316,684 @@ ARangeSet::ARangeSet(DWARFReader &r)
 }
 
 Unit::Unit(const Info *di, DWARFReader &r)
-    : dwarf(di)
+    : decoded(false)
+    , rootRead(false)
+    , dwarf(di)
     , io(r.io)
     , offset(r.getOffset())
 {
     length = r.getlength(&dwarfLen);
-    Elf::Off nextoff = r.getOffset() + length;
+    end = r.getOffset() + length;
     version = r.getu16();
 
     if (version <= 2) // DWARF Version 2 uses the architecture's address size.
        dwarfLen = ELF_BITS / 8;
 
-    off_t off = r.getuint(version <= 2 ? 4 : dwarfLen);
-    DWARFReader abbR(di->abbrev, off);
-    r.addrLen = addrlen = r.getu8();
-    uintmax_t code;
-    while ((code = abbR.getuleb128()) != 0)
-        abbreviations.emplace( std::piecewise_construct,
-                std::forward_as_tuple(code),
-                std::forward_as_tuple(abbR));
-    DWARFReader entriesR(r.io, r.getOffset(), nextoff);
-    assert(nextoff <= r.getLimit());
-    decodeEntries(entriesR, entries);
-    r.setOffset(nextoff);
+    off_t off;
+    if (version >= 5) {
+        unitType = r.getu8();
+        r.addrLen = addrlen = r.getu8();
+        off = r.getuint(dwarfLen);
+        switch (unitType) {
+            case DW_UT_skeleton:
+            case DW_UT_split_compile:
+                r.skip(8); // dwo_id
+                break;
+            case DW_UT_type:
+            case DW_UT_split_type:
+                r.skip(8 + dwarfLen); // type signature and offset.
+                break;
+            default:
+                break;
+        }
+    } else {
+        unitType = DW_UT_compile;
+        off = r.getuint(version <= 2 ? 4 : dwarfLen);
+        r.addrLen = addrlen = r.getu8();
+    }
+    format.addrLen = addrlen;
+    format.offsetLen = dwarfLen;
+    format.strpLen = version <= 2 ? 4 : dwarfLen;
+    abbreviations = di->getAbbrevTable(off, format);
+    entriesOffset = r.getOffset();
+    assert(end <= r.getLimit());
+    r.setOffset(end);
+}
+
+void
+Unit::decode() const
+{
+    if (decoded)
+        return;
+    decoded = true;
+    DWARFReader r(io, entriesOffset, end);
+    decodeEntries(r);
 }
 
 DIE
-Unit::offsetToDIE(size_t offset) const
+Unit::entryAt(size_t idx) const
 {
-    auto it = allEntries.find(offset);
-    return it != allEntries.end() ? DIE(this, offset, &it->second) : DIE();
+    return DIE(this, offset + entryOffsets[idx], &entries[idx]);
+}
+
+DIE
+Unit::offsetToDIE(size_t offset_) const
+{
+    if (off_t(offset_) < offset || offset_ >= end)
+        return DIE();
+    decode();
+    uint32_t unitOffset = offset_ - offset;
+    auto it = std::lower_bound(entryOffsets.begin(), entryOffsets.end(), unitOffset);
+    if (it == entryOffsets.end() || *it != unitOffset)
+        return DIE();
+    return entryAt(it - entryOffsets.begin());
 }
 
 string
 Unit::name() const
 {
-    assert(entries.begin() != entries.end());
-    for (const auto &top : topLevelDIEs())
-        return top.name();
-    return "";
+    DWARFReader r(io, entriesOffset, end);
+    auto root = rootEntry(r);
+    Form form;
+    Value value;
+    if (root == nullptr || !readAttribute(r, *root, DW_AT_name, form, value))
+        return "";
+    return formString(this, form, value);
+}
+
+void
+Unit::readRoot() const
+{
+    if (rootRead)
+        return;
+    rootRead = true;
+    baseAddr = 0;
+    strOffsetsBase = 0;
+    addrBase = 0;
+    rnglistsBase = 0;
+    loclistsBase = 0;
+    DWARFReader r(io, entriesOffset, end);
+    auto root = rootEntry(r);
+    if (root == nullptr)
+        return;
+    Form form;
+    Value value;
+    auto read = [this, &r, root, &form, &value] (AttrName name) {
+        DWARFReader ar(r);
+        return readAttribute(ar, *root, name, form, value);
+    };
+    if (read(DW_AT_str_offsets_base))
+        strOffsetsBase = value.addr;
+    if (read(DW_AT_addr_base))
+        addrBase = value.addr;
+    if (read(DW_AT_rnglists_base))
+        rnglistsBase = value.addr;
+    if (read(DW_AT_loclists_base))
+        loclistsBase = value.addr;
+    if (read(DW_AT_low_pc))
+        baseAddr = form == DW_FORM_addr ? value.addr : addrx(value.udata);
+}
+
+Elf::Addr
+Unit::addrx(uintmax_t idx) const
+{
+    readRoot();
+    if (!dwarf->addrTable)
+        throw (Exception() << "no .debug_addr section for indexed address");
+    DWARFReader r(dwarf->addrTable, addrBase + idx * addrlen);
+    return r.getuint(addrlen);
+}
+
+string
+Unit::strx(uintmax_t idx) const
+{
+    readRoot();
+    if (!dwarf->strOffsets || !dwarf->debugStrings)
+        return "(string offsets table unavailable)";
+    DWARFReader r(dwarf->strOffsets, strOffsetsBase + idx * dwarfLen);
+    return dwarf->debugStrings->readString(r.getuint(dwarfLen));
+}
+
+static bool
+isAddrx(Form form)
+{
+    switch (form) {
+        case DW_FORM_addrx:
+        case DW_FORM_addrx1:
+        case DW_FORM_addrx2:
+        case DW_FORM_addrx3:
+        case DW_FORM_addrx4:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool
+Unit::entryRanges(const DWARFReader &attrs, const Abbreviation &type, RangeList &ranges) const
+{
+    Form form, highForm;
+    Value value, high;
+    DWARFReader r(attrs);
+    if (readAttribute(r, type, DW_AT_ranges, form, value)) {
+        rangeList(form, value, ranges);
+        return true;
+    }
+    r = attrs;
+    if (!readAttribute(r, type, DW_AT_low_pc, form, value))
+        return false;
+    r = attrs;
+    if (!readAttribute(r, type, DW_AT_high_pc, highForm, high))
+        return false;
+
+    Elf::Addr start, end;
+    if (form == DW_FORM_addr)
+        start = value.addr;
+    else if (isAddrx(form))
+        start = addrx(value.udata);
+    else
+        return false;
+
+    switch (highForm) {
+        case DW_FORM_addr:
+            end = high.addr;
+            break;
+        case DW_FORM_addrx:
+        case DW_FORM_addrx1:
+        case DW_FORM_addrx2:
+        case DW_FORM_addrx3:
+        case DW_FORM_addrx4:
+            end = addrx(high.udata);
+            break;
+        case DW_FORM_data1:
+        case DW_FORM_data2:
+        case DW_FORM_data4:
+        case DW_FORM_data8:
+        case DW_FORM_udata:
+        case DW_FORM_implicit_const:
+            end = start + high.udata;
+            break;
+        default:
+            return false;
+    }
+    ranges.emplace_back(start, end);
+    return true;
+}
+
+void
+Unit::rangeList(Form form, const Value &value, RangeList &ranges) const
+{
+    readRoot();
+    Elf::Addr base = baseAddr;
+
+    if (version < 5) {
+        // .debug_ranges: pairs of addresses, relative to the base address,
+        // terminated by a pair of zeros. A start address of all-ones selects
+        // a new base address.
+        if (!dwarf->rangesh)
+            return;
+        Elf::Addr selector = addrlen >= sizeof (Elf::Addr)
+            ? ~Elf::Addr(0) : (Elf::Addr(1) << addrlen * 8) - 1;
+        DWARFReader r(dwarf->rangesh, value.addr);
+        while (!r.empty()) {
+            Elf::Addr start = r.getuint(addrlen);
+            Elf::Addr end = r.getuint(addrlen);
+            if (start == 0 && end == 0)
+                break;
+            if (start == selector)
+                base = end;
+            else
+                ranges.emplace_back(base + start, base + end);
+        }
+        return;
+    }
+
+    if (!dwarf->rnglistsh)
+        return;
+    Elf::Off off;
+    if (form == DW_FORM_rnglistx) {
+        // Index into the offsets table at the start of the unit's
+        // contribution to .debug_rnglists.
+        DWARFReader r(dwarf->rnglistsh, rnglistsBase + value.udata * dwarfLen);
+        off = rnglistsBase + r.getuint(dwarfLen);
+    } else {
+        off = value.addr;
+    }
+    DWARFReader r(dwarf->rnglistsh, off);
+    for (;;) {
+        auto kind = RangeListEntry(r.getu8());
+        switch (kind) {
+            case DW_RLE_end_of_list:
+                return;
+            case DW_RLE_base_addressx:
+                base = addrx(r.getuleb128());
+                break;
+            case DW_RLE_startx_endx: {
+                Elf::Addr start = addrx(r.getuleb128());
+                ranges.emplace_back(start, addrx(r.getuleb128()));
+                break;
+            }
+            case DW_RLE_startx_length: {
+                Elf::Addr start = addrx(r.getuleb128());
+                ranges.emplace_back(start, start + r.getuleb128());
+                break;
+            }
+            case DW_RLE_offset_pair: {
+                Elf::Addr start = base + r.getuleb128();
+                ranges.emplace_back(start, base + r.getuleb128());
+                break;
+            }
+            case DW_RLE_base_address:
+                base = r.getuint(addrlen);
+                break;
+            case DW_RLE_start_end: {
+                Elf::Addr start = r.getuint(addrlen);
+                ranges.emplace_back(start, r.getuint(addrlen));
+                break;
+            }
+            case DW_RLE_start_length: {
+                Elf::Addr start = r.getuint(addrlen);
+                ranges.emplace_back(start, start + r.getuleb128());
+                break;
+            }
+            default:
+                throw (Exception() << "unknown range list entry " << int(kind)
+                      << " at offset " << r.getOffset() - 1 << " in " << *dwarf->rnglistsh);
+        }
+    }
+}
+
+bool
+Unit::locationList(Form form, const Value &value, Elf::Addr addr, Block &location) const
+{
+    if (!dwarf->loclistsh)
+        return false;
+    readRoot();
+    Elf::Addr base = baseAddr;
+    Elf::Off off;
+    if (form == DW_FORM_loclistx) {
+        // Index into the offsets table at the start of the unit's
+        // contribution to .debug_loclists.
+        DWARFReader r(dwarf->loclistsh, loclistsBase + value.udata * dwarfLen);
+        off = loclistsBase + r.getuint(dwarfLen);
+    } else {
+        off = value.addr;
+    }
+    DWARFReader r(dwarf->loclistsh, off);
+    bool haveDefault = false;
+    Block defaultLocation;
+    for (;;) {
+        auto kind = LocationListEntry(r.getu8());
+        Elf::Addr start = 0, end = 0;
+        switch (kind) {
+            case DW_LLE_end_of_list:
+                if (haveDefault)
+                    location = defaultLocation;
+                return haveDefault;
+            case DW_LLE_base_addressx:
+                base = addrx(r.getuleb128());
+                continue;
+            case DW_LLE_base_address:
+                base = r.getuint(addrlen);
+                continue;
+            case DW_LLE_GNU_view_pair: // we don't use location views.
+                r.getuleb128();
+                r.getuleb128();
+                continue;
+            case DW_LLE_startx_endx:
+                start = addrx(r.getuleb128());
+                end = addrx(r.getuleb128());
+                break;
+            case DW_LLE_startx_length:
+                start = addrx(r.getuleb128());
+                end = start + r.getuleb128();
+                break;
+            case DW_LLE_offset_pair:
+                start = base + r.getuleb128();
+                end = base + r.getuleb128();
+                break;
+            case DW_LLE_default_location:
+                break;
+            case DW_LLE_start_end:
+                start = r.getuint(addrlen);
+                end = r.getuint(addrlen);
+                break;
+            case DW_LLE_start_length:
+                start = r.getuint(addrlen);
+                end = start + r.getuleb128();
+                break;
+            default:
+                throw (Exception() << "unknown location list entry " << int(kind)
+                      << " at offset " << r.getOffset() - 1 << " in " << *dwarf->loclistsh);
+        }
+        Block block;
+        block.length = r.getuleb128();
+        block.offset = r.getOffset();
+        r.skip(block.length);
+        if (kind == DW_LLE_default_location) {
+            haveDefault = true;
+            defaultLocation = block;
+        } else if (addr >= start && addr < end) {
+            location = block;
+            return true;
+        }
+    }
+}
+
+const Abbreviation *
+Unit::rootEntry(DWARFReader &r) const
+{
+    r.setOffset(entriesOffset);
+    if (r.empty())
+        return nullptr;
+    return findAbbreviation(r.getuleb128());
+}
+
+bool
+Unit::readAttribute(DWARFReader &r, const Abbreviation &type, AttrName name,
+        Form &form, Value &value) const
+{
+    int idx = type.attrIndex(name);
+    if (idx == -1)
+        return false;
+    form = type.forms[idx];
+    if (form == DW_FORM_implicit_const) {
+        value.sdata = type.constants[idx];
+        return true;
+    }
+    if (type.offsets[idx] != -1) {
+        r.skip(type.offsets[idx]);
+    } else {
+        // Skip the plan steps before the attribute, and then any forms
+        // preceding it in its own step.
+        const PlanStep *step;
+        for (step = &type.plan[0]; step->first + step->count <= size_t(idx); ++step)
+            skipStep(r, type, *step);
+        Value dummy;
+        for (size_t i = step->first; i < size_t(idx); ++i)
+            readValue(r, type.forms[i], dummy);
+    }
+    readValue(r, form, value);
+    return true;
+}
+
+void
+Unit::skipStep(DWARFReader &r, const Abbreviation &type, const PlanStep &step) const
+{
+    switch (step.type) {
+    case PLAN_FIXED:
+        r.skip(step.size);
+        break;
+    case PLAN_LEB128:
+        r.skipleb128(step.count);
+        break;
+    case PLAN_STRING: {
+        char buf[64];
+        for (;;) {
+            size_t avail = std::min(sizeof buf, size_t(r.getLimit() - r.getOffset()));
+            if (avail == 0)
+                throw (Exception() << "unterminated string in " << *io);
+            r.io->readObj(r.getOffset(), buf, avail);
+            auto nul = static_cast<const char *>(memchr(buf, 0, avail));
+            if (nul != nullptr) {
+                r.skip(nul - buf + 1);
+                break;
+            }
+            r.skip(avail);
+        }
+        break;
+    }
+    case PLAN_BLOCK: {
+        Elf::Off len;
+        switch (type.forms[step.first]) {
+        case DW_FORM_block1: len = r.getu8(); break;
+        case DW_FORM_block2: len = r.getu16(); break;
+        case DW_FORM_block4: len = r.getu32(); break;
+        default: len = r.getuleb128(); break;
+        }
+        r.skip(len);
+        break;
+    }
+    case PLAN_CONST:
+        break;
+    case PLAN_OTHER: {
+        Value dummy;
+        for (size_t i = step.first; i < size_t(step.first + step.count); ++i)
+            readValue(r, type.forms[i], dummy);
+        break;
+    }
+    }
+}
+
+void
+Unit::skipAttributes(DWARFReader &r, const Abbreviation &type) const
+{
+    if (type.fixedSize != -1) {
+        r.skip(type.fixedSize);
+        return;
+    }
+    for (const auto &step : type.plan)
+        skipStep(r, type, step);
+}
+
+void
+Unit::skipEntry(DWARFReader &r, const Abbreviation &type) const
+{
+    if (type.hasChildren) {
+        // If there's a sibling reference, we can jump straight past the
+        // subtree.
+        Elf::Off start = r.getOffset();
+        Form form;
+        Value value;
+        if (readAttribute(r, type, DW_AT_sibling, form, value) && form != DW_FORM_ref_addr) {
+            r.setOffset(offset + value.addr);
+            return;
+        }
+        r.setOffset(start);
+    }
+    skipAttributes(r, type);
+    if (!type.hasChildren)
+        return;
+    while (!r.empty()) {
+        size_t code = r.getuleb128();
+        if (code == 0)
+            return;
+        auto child = findAbbreviation(code);
+        if (child == nullptr)
+            throw (Exception() << "no abbreviation " << code << " in " << *io);
+        skipEntry(r, *child);
+    }
+}
+
+size_t
+Unit::memoryUsed() const
+{
+    return sizeof *this
+        + entries.capacity() * sizeof entries[0]
+        + entryOffsets.capacity() * sizeof entryOffsets[0]
+        + values.capacity() * sizeof values[0]
+        + blocks.size() * sizeof blocks[0]
+        + (lines ? lines->memoryUsed() : 0);
 }
 
 Unit::~Unit() = default;
 
-Abbreviation::Abbreviation(DWARFReader &r)
+Abbreviation::Abbreviation(DWARFReader &r, const UnitFormat &format)
 {
     tag = Tag(r.getuleb128());
     hasChildren = HasChildren(r.getu8()) == DW_CHILDREN_yes;
+    memset(attrIdx, NOATTR, sizeof attrIdx);
     for (size_t i = 0;; ++i) {
         auto name = AttrName(r.getuleb128());
         auto form = Form(r.getuleb128());
         if (name == 0 && form == 0)
             break;
         forms.emplace_back(form);
-        attrName2Idx[name] = i;
+        names.emplace_back(name);
+        constants.emplace_back(form == DW_FORM_implicit_const ? r.getsleb128() : 0);
+        if (name < ATTRTABLESIZE && i < NOATTR)
+            attrIdx[name] = i;
     }
+    makePlan(format);
+}
+
+/*
+ * The encoded size of a form whose size doesn't depend on its content, or -1
+ * for those that do.
+ */
+static int
+fixedFormSize(Form form, const UnitFormat &format)
+{
+    switch (form) {
+    case DW_FORM_flag_present:
+        return 0;
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+        return 1;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+        return 2;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+        return 3;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+        return 4;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+        return 8;
+    case DW_FORM_addr:
+        return format.addrLen;
+    case DW_FORM_strp:
+        return format.strpLen;
+    case DW_FORM_sec_offset:
+    case DW_FORM_ref_addr:
+    case DW_FORM_GNU_ref_alt:
+    case DW_FORM_GNU_strp_alt:
+    case DW_FORM_strp_sup:
+    case DW_FORM_line_strp:
+        return format.offsetLen;
+    default:
+        return -1;
+    }
+}
+
+void
+Abbreviation::makePlan(const UnitFormat &format)
+{
+    int32_t off = 0;
+    for (size_t i = 0; i < forms.size(); ++i) {
+        offsets.push_back(off);
+        int size = fixedFormSize(forms[i], format);
+        PlanStepType type;
+        if (forms[i] == DW_FORM_implicit_const) {
+            type = PLAN_CONST;
+            size = 0;
+        } else if (size != -1) {
+            type = PLAN_FIXED;
+        } else {
+            switch (forms[i]) {
+            case DW_FORM_udata:
+            case DW_FORM_sdata:
+            case DW_FORM_ref_udata:
+            case DW_FORM_strx:
+            case DW_FORM_addrx:
+            case DW_FORM_loclistx:
+            case DW_FORM_rnglistx:
+                type = PLAN_LEB128;
+                break;
+            case DW_FORM_string:
+                type = PLAN_STRING;
+                break;
+            case DW_FORM_block1:
+            case DW_FORM_block2:
+            case DW_FORM_block4:
+            case DW_FORM_block:
+            case DW_FORM_exprloc:
+                type = PLAN_BLOCK;
+                break;
+            default:
+                type = PLAN_OTHER;
+                break;
+            }
+        }
+        if (off != -1)
+            off = size == -1 ? -1 : off + size;
+        if (!plan.empty() && plan.back().type == type
+                && (type == PLAN_FIXED || type == PLAN_LEB128)) {
+            plan.back().count++;
+            plan.back().size += size == -1 ? 0 : size;
+        } else {
+            plan.push_back(PlanStep{ type, uint16_t(i), 1, uint32_t(size == -1 ? 0 : size) });
+        }
+    }
+    fixedSize = off;
+}
+
+int
+Abbreviation::attrIndex(AttrName name) const
+{
+    if (name < ATTRTABLESIZE && names.size() < NOATTR)
+        return attrIdx[name] == NOATTR ? -1 : attrIdx[name];
+    auto it = std::find(names.begin(), names.end(), name);
+    return it == names.end() ? -1 : it - names.begin();
+}
+
+AbbrevTable::AbbrevTable(DWARFReader &r, const UnitFormat &format)
+{
+    std::vector<std::pair<size_t, Abbreviation>> all;
+    size_t maxCode = 0;
+    uintmax_t code;
+    while ((code = r.getuleb128()) != 0) {
+        all.emplace_back(std::piecewise_construct,
+                std::forward_as_tuple(code),
+                std::forward_as_tuple(r, format));
+        maxCode = std::max(maxCode, size_t(code));
+    }
+    if (maxCode <= all.size() * 2 + 16) {
+        dense.resize(maxCode);
+        for (auto &abbrev : all)
+            dense[abbrev.first - 1] = std::move(abbrev.second);
+    } else {
+        for (auto &abbrev : all)
+            sparse.emplace(abbrev.first, std::move(abbrev.second));
+    }
+}
+
+const Abbreviation *
+AbbrevTable::find(size_t code) const
+{
+    if (code - 1 < dense.size())
+        return dense[code - 1].tag != DW_TAG_none ? &dense[code - 1] : nullptr;
+    auto it = sparse.find(code);
+    return it != sparse.end() ? &it->second : nullptr;
+}
+
+AbbrevTable::csptr
+Info::getAbbrevTable(Elf::Off offset, const UnitFormat &format) const
+{
+    auto &table = abbrevTables[std::make_pair(offset, format.key())];
+    if (table == nullptr) {
+        DWARFReader r(abbrev, offset);
+        table = make_shared<AbbrevTable>(r, format);
+    }
+    return table;
 }
 
 AttrName
 Attribute::name() const
 {
-    size_t off = formp - &dieref.die->type->forms[0];
-    for (auto ent : dieref.die->type->attrName2Idx) {
-        if (ent.second == off)
-            return ent.first;
-    }
-    return DW_AT_none;
+    return dieref.die->type->names[formp - &dieref.die->type->forms[0]];
 }
 
 Attribute::operator intmax_t() const
@@ -288,6 +1007,7 @@ Attribute::operator intmax_t() const
     case DW_FORM_data8:
     case DW_FORM_sdata:
     case DW_FORM_udata:
+    case DW_FORM_implicit_const:
         return value().sdata;
     case DW_FORM_sec_offset:
         return value().addr;
@@ -306,32 +1026,200 @@ Attribute::operator uintmax_t() const
     case DW_FORM_data4:
     case DW_FORM_data8:
      case DW_FORM_udata:
+    case DW_FORM_implicit_const:
         return value().udata;
     case DW_FORM_addr:
     case DW_FORM_sec_offset:
         return value().addr;
+    case DW_FORM_addrx:
+    case DW_FORM_addrx1:
+    case DW_FORM_addrx2:
+    case DW_FORM_addrx3:
+    case DW_FORM_addrx4:
+        return dieref.unit->addrx(value().udata);
     default:
         abort();
     }
 }
 
-LineState::LineState(LineInfo *li)
+LineState::LineState(bool default_is_stmt)
     : addr { 0 }
-    , file { &li->files[1] }
+    , file { 1 }
     , line { 1 }
     , column { 0 }
     , isa { 0 }
-    , is_stmt { li->default_is_stmt }
+    , is_stmt { default_is_stmt }
     , basic_block { false }
     , end_sequence { false }
     , prologue_end { false }
     , epilogue_begin { false }
 {}
 
+void
+LineInfo::addRow(const LineState &state)
+{
+    // Rows store their address as a 32-bit offset from the start of the
+    // sequence: if the address goes backwards, or too far forwards, start a
+    // new sequence.
+    if (inSequence) {
+        auto &seq = sequences.back();
+        if (state.addr < seq.start || state.addr - seq.start > std::numeric_limits<uint32_t>::max())
+            endSequence(state.addr, nullptr);
+    }
+    if (!inSequence) {
+        sequences.push_back(LineSequence{ state.addr, state.addr,
+              uint32_t(rows.size()), uint32_t(rows.size()), 0, 0, false });
+        inSequence = true;
+    }
+    if (state.file > std::numeric_limits<uint16_t>::max() && verbose > 0)
+        *debug << "warning: file index " << state.file << " too large in line table" << std::endl;
+    auto &seq = sequences.back();
+    rows.push_back(LineRow{ uint32_t(state.addr - seq.start), state.line,
+          uint16_t(state.file <= std::numeric_limits<uint16_t>::max() ? state.file : 0) });
+    seq.lastRow = rows.size();
+    seq.end = state.addr;
+}
+
+void
+LineInfo::endSequence(Elf::Addr end, const LineState *state)
+{
+    if (!inSequence)
+        sequences.push_back(LineSequence{ end, end,
+              uint32_t(rows.size()), uint32_t(rows.size()), 0, 0, false });
+    auto &seq = sequences.back();
+    seq.end = end;
+    if (state != nullptr) {
+        seq.endLine = state->line;
+        seq.endFile = state->file <= std::numeric_limits<uint16_t>::max() ? state->file : 0;
+        seq.endSequence = true;
+    }
+    inSequence = false;
+}
+
+size_t
+LineInfo::memoryUsed() const
+{
+    size_t total = sizeof *this
+        + rows.capacity() * sizeof rows[0]
+        + sequences.capacity() * sizeof sequences[0]
+        + (byAddr.capacity() + maxEnd.capacity()) * sizeof maxEnd[0]
+        + files.capacity() * sizeof files[0];
+    for (auto &dir : directories)
+        total += sizeof dir + dir.capacity();
+    return total;
+}
+
+void
+LineInfo::find(Elf::Addr addr, std::vector<const LineRow *> &found) const
+{
+    auto it = std::upper_bound(byAddr.begin(), byAddr.end(), addr,
+            [this](Elf::Addr addr, uint32_t seq) { return addr < sequences[seq].start; });
+    size_t start = found.size();
+    for (size_t i = it - byAddr.begin(); i-- > 0 && maxEnd[i] > addr;) {
+        const auto &seq = sequences[byAddr[i]];
+        if (addr >= seq.end || seq.firstRow == seq.lastRow)
+            continue;
+        uint32_t offset = addr - seq.start;
+        auto row = std::upper_bound(rows.begin() + seq.firstRow, rows.begin() + seq.lastRow,
+                offset, [](uint32_t offset, const LineRow &row) { return offset < row.addr; });
+        found.push_back(&*--row);
+    }
+    // we found them in descending address order.
+    std::reverse(found.begin() + start, found.end());
+}
+
+/*
+ * Read the value of a field of a directory or file entry in a DWARF 5 line
+ * table header. Strings are returned in "str", everything else in "num".
+ */
 static void
-dwarfStateAddRow(LineInfo *li, const LineState &state)
+readEntryField(DWARFReader &r, Form form, const Unit *unit, size_t dwarfLen,
+        string &str, uintmax_t &num)
 {
-    li->matrix.push_back(state);
+    switch (form) {
+        case DW_FORM_string:
+            str = r.getstring();
+            break;
+        case DW_FORM_line_strp: {
+            auto off = r.getuint(dwarfLen);
+            str = unit->dwarf->lineStrings ? unit->dwarf->lineStrings->readString(off) : "unknown";
+            break;
+        }
+        case DW_FORM_strp: {
+            auto off = r.getuint(dwarfLen);
+            str = unit->dwarf->debugStrings ? unit->dwarf->debugStrings->readString(off) : "unknown";
+            break;
+        }
+        case DW_FORM_strx:
+        case DW_FORM_udata:
+            num = r.getuleb128();
+            if (form == DW_FORM_strx)
+                str = unit->strx(num);
+            break;
+        case DW_FORM_strx1:
+        case DW_FORM_data1:
+            num = r.getu8();
+            if (form == DW_FORM_strx1)
+                str = unit->strx(num);
+            break;
+        case DW_FORM_strx2:
+        case DW_FORM_data2:
+            num = r.getu16();
+            if (form == DW_FORM_strx2)
+                str = unit->strx(num);
+            break;
+        case DW_FORM_strx4:
+        case DW_FORM_data4:
+            num = r.getu32();
+            if (form == DW_FORM_strx4)
+                str = unit->strx(num);
+            break;
+        case DW_FORM_data8:
+            num = r.getuint(8);
+            break;
+        case DW_FORM_data16:
+            r.skip(16);
+            break;
+        case DW_FORM_block:
+            r.skip(r.getuleb128());
+            break;
+        default:
+            throw (Exception() << "unsupported form " << int(form)
+                  << " in line table header of " << *r.io);
+    }
+}
+
+/*
+ * Read the directory or file name entries of a DWARF 5 line table header,
+ * calling "add" with the path, directory index, modification time, and size
+ * of each.
+ */
+template <typename Add> static void
+readEntries(DWARFReader &r, const Unit *unit, size_t dwarfLen, Add add)
+{
+    enum { DW_LNCT_path = 1, DW_LNCT_directory_index, DW_LNCT_timestamp, DW_LNCT_size };
+    std::vector<std::pair<uintmax_t, Form>> format(r.getu8());
+    for (auto &field : format) {
+        field.first = r.getuleb128();
+        field.second = Form(r.getuleb128());
+    }
+    for (auto count = r.getuleb128(); count != 0; --count) {
+        string path;
+        uintmax_t dir = 0, lastMod = 0, length = 0;
+        for (const auto &field : format) {
+            string str;
+            uintmax_t num = 0;
+            readEntryField(r, field.second, unit, dwarfLen, str, num);
+            switch (field.first) {
+                case DW_LNCT_path: path = str; break;
+                case DW_LNCT_directory_index: dir = num; break;
+                case DW_LNCT_timestamp: lastMod = num; break;
+                case DW_LNCT_size: length = num; break;
+                default: break;
+            }
+        }
+        add(path, dir, lastMod, length);
+    }
 }
 
 void
@@ -342,7 +1230,10 @@ LineInfo::build(DWARFReader &r, const Unit *unit)
     Elf::Off end = r.getOffset() + total_length;
 
     uint16_t version = r.getu16();
-    (void)version;
+    if (version >= 5) {
+        r.getu8(); // address_size
+        r.getu8(); // segment_selector_size
+    }
     Elf::Off header_length = r.getuint(version > 2 ? dwarfLen: 4);
     Elf::Off expectedEnd = header_length + r.getOffset();
     int min_insn_length = r.getu8();
@@ -359,25 +1250,42 @@ LineInfo::build(DWARFReader &r, const Unit *unit)
     for (size_t i = 1; i < opcode_base; ++i)
         opcode_lengths[i] = r.getu8();
 
-    directories.emplace_back(".");
-    int count;
-    for (count = 0;; count++) {
-        const auto &s = r.getstring();
-        if (s == "")
-            break;
-        directories.push_back(s);
-    }
+    if (version >= 5) {
+        // DWARF 5 describes the layout of the directory and file entries,
+        // and they are numbered from zero.
+        readEntries(r, unit, dwarfLen,
+                [this] (const string &path, uintmax_t, uintmax_t, uintmax_t) {
+                    directories.push_back(path);
+                });
+        readEntries(r, unit, dwarfLen,
+                [this] (const string &path, uintmax_t dir, uintmax_t lastMod, uintmax_t length) {
+                    files.emplace_back(path, dir < directories.size() ? directories[dir] : "unknown",
+                          unsigned(lastMod), unsigned(length));
+                });
+    } else {
+        directories.emplace_back(".");
+        int count;
+        for (count = 0;; count++) {
+            const auto &s = r.getstring();
+            if (s == "")
+                break;
+            directories.push_back(s);
+        }
 
-    files.emplace_back("unknown", "unknown", 0U, 0U); // index 0 is special
-    for (count = 1;; count++) {
-        char c;
-        r.io->readObj(r.getOffset(), &c);
-        if (c == 0) {
-            r.getu8(); // skip terminator.
-            break;
+        files.emplace_back("unknown", "unknown", 0U, 0U); // index 0 is special
+        for (count = 1;; count++) {
+            char c;
+            r.io->readObj(r.getOffset(), &c);
+            if (c == 0) {
+                r.getu8(); // skip terminator.
+                break;
+            }
+            files.emplace_back(r, this);
         }
-        files.emplace_back(r, this);
     }
+    // Make sure any file index in the program refers to something.
+    if (files.size() < 2)
+        files.resize(2);
 
     auto diff = expectedEnd - r.getOffset();
     if (diff != 0) {
@@ -387,7 +1295,8 @@ LineInfo::build(DWARFReader &r, const Unit *unit)
         r.skip(diff);
     }
 
-    LineState state(this);
+    inSequence = false;
+    LineState state(default_is_stmt);
     while (r.getOffset() < end) {
         unsigned c = r.getu8();
         if (c >= opcode_base) {
@@ -397,7 +1306,7 @@ LineInfo::build(DWARFReader &r, const Unit *unit)
             int lineIncr = c % line_range + line_base;
             state.addr += addrIncr * min_insn_length;
             state.line += lineIncr;
-            dwarfStateAddRow(this, state);
+            addRow(state);
             state.basic_block = false;
 
         } else if (c == 0) {
@@ -407,8 +1316,8 @@ LineInfo::build(DWARFReader &r, const Unit *unit)
             switch (code) {
             case DW_LNE_end_sequence:
                 state.end_sequence = true;
-                dwarfStateAddRow(this, state);
-                state = LineState(this);
+                endSequence(state.addr, &state);
+                state = LineState(default_is_stmt);
                 break;
             case DW_LNE_set_address:
                 state.addr = r.getuint(unit->addrlen);
@@ -439,10 +1348,10 @@ LineInfo::build(DWARFReader &r, const Unit *unit)
                 state.line += r.getsleb128();
                 break;
             case DW_LNS_set_file:
-                state.file = &files[r.getuleb128()];
+                state.file = r.getuleb128();
                 break;
             case DW_LNS_copy:
-                dwarfStateAddRow(this, state);
+                addRow(state);
                 state.basic_block = false;
                 break;
             case DW_LNS_set_column:
@@ -474,6 +1383,17 @@ LineInfo::build(DWARFReader &r, const Unit *unit)
             }
         }
     }
+    if (inSequence)
+        endSequence(sequences.back().end, nullptr);
+
+    byAddr.resize(sequences.size());
+    for (size_t i = 0; i < byAddr.size(); ++i)
+        byAddr[i] = i;
+    std::stable_sort(byAddr.begin(), byAddr.end(),
+            [this](uint32_t l, uint32_t r) { return sequences[l].start < sequences[r].start; });
+    maxEnd.resize(byAddr.size());
+    for (size_t i = 0; i < byAddr.size(); ++i)
+        maxEnd[i] = std::max(i == 0 ? 0 : maxEnd[i - 1], sequences[byAddr[i]].end);
 }
 
 FileEntry::FileEntry(string name_, string dir_, unsigned lastMod_, unsigned length_)
@@ -492,14 +1412,14 @@ FileEntry::FileEntry(DWARFReader &r, LineInfo *info)
 {
 }
 
-Attribute::operator std::string() const
+static string
+formString(const Unit *unit, Form form, const Value &value)
 {
-    if (!valid())
-        return "";
-    const Info *dwarf = dieref.unit->dwarf;
+    const Info *dwarf = unit->dwarf;
     assert(dwarf != nullptr);
-    switch (*formp) {
+    switch (form) {
 
+        case DW_FORM_strp_sup:
         case DW_FORM_GNU_strp_alt: {
             const auto &alt = dwarf->getAltDwarf();
             if (!alt)
@@ -507,39 +1427,58 @@ Attribute::operator std::string() const
             auto &strs = alt->debugStrings;
             if (!strs)
                 return "(alt string table unavailable)";
-            return strs->readString(value().addr);
+            return strs->readString(value.addr);
         }
         case DW_FORM_strp:
-            return dwarf->debugStrings->readString(value().addr);
+            return dwarf->debugStrings->readString(value.addr);
 
         case DW_FORM_string:
-            return dieref.unit->io->readString(value().addr);
+            return unit->io->readString(value.addr);
+
+        case DW_FORM_line_strp:
+            if (!dwarf->lineStrings)
+                return "(line string table unavailable)";
+            return dwarf->lineStrings->readString(value.addr);
+
+        case DW_FORM_strx:
+        case DW_FORM_strx1:
+        case DW_FORM_strx2:
+        case DW_FORM_strx3:
+        case DW_FORM_strx4:
+            return unit->strx(value.udata);
 
         default:
             abort();
     }
 }
 
+Attribute::operator std::string() const
+{
+    if (!valid())
+        return "";
+    return formString(dieref.unit, *formp, value());
+}
+
 void
-RawDIE::readValue(DWARFReader &r, Form form, Value &value, const Unit *unit)
+Unit::readValue(DWARFReader &r, Form form, Value &value) const
 {
     switch (form) {
 
     case DW_FORM_GNU_strp_alt: {
-        value.addr = r.getint(unit->dwarfLen);
+        value.addr = r.getint(dwarfLen);
         break;
     }
 
     case DW_FORM_strp:
-        value.addr = r.getint(unit->version <= 2 ? 4 : unit->dwarfLen);
+        value.addr = r.getint(version <= 2 ? 4 : dwarfLen);
         break;
 
     case DW_FORM_GNU_ref_alt:
-        value.addr = r.getuint(unit->dwarfLen);
+        value.addr = r.getuint(dwarfLen);
         break;
 
     case DW_FORM_addr:
-        value.addr = r.getuint(unit->addrlen);
+        value.addr = r.getuint(addrlen);
         break;
 
     case DW_FORM_data1:
@@ -583,7 +1522,7 @@ RawDIE::readValue(DWARFReader &r, Form form, Value &value, const Unit *unit)
         break;
 
     case DW_FORM_ref_addr:
-        value.addr = r.getuint(unit->dwarfLen);
+        value.addr = r.getuint(dwarfLen);
         break;
 
     case DW_FORM_ref8:
@@ -596,21 +1535,24 @@ RawDIE::readValue(DWARFReader &r, Form form, Value &value, const Unit *unit)
         break;
 
     case DW_FORM_block1:
-        value.block = new Block();
+        blocks.emplace_back();
+        value.block = &blocks.back();
         value.block->length = r.getu8();
         value.block->offset = r.getOffset();
         r.skip(value.block->length);
         break;
 
     case DW_FORM_block2:
-        value.block = new Block();
+        blocks.emplace_back();
+        value.block = &blocks.back();
         value.block->length = r.getu16();
         value.block->offset = r.getOffset();
         r.skip(value.block->length);
         break;
 
     case DW_FORM_block4:
-        value.block = new Block();
+        blocks.emplace_back();
+        value.block = &blocks.back();
         value.block->length = r.getu32();
         value.block->offset = r.getOffset();
         r.skip(value.block->length);
@@ -618,7 +1560,8 @@ RawDIE::readValue(DWARFReader &r, Form form, Value &value, const Unit *unit)
 
     case DW_FORM_exprloc:
     case DW_FORM_block:
-        value.block = new Block();
+        blocks.emplace_back();
+        value.block = &blocks.back();
         value.block->length = r.getuleb128();
         value.block->offset = r.getOffset();
         r.skip(value.block->length);
@@ -633,11 +1576,56 @@ RawDIE::readValue(DWARFReader &r, Form form, Value &value, const Unit *unit)
         break;
 
     case DW_FORM_sec_offset:
-        value.addr = r.getint(unit->dwarfLen);
+        value.addr = r.getint(dwarfLen);
         break;
 
     case DW_FORM_ref_sig8:
-        value.addr = r.getu8();
+    case DW_FORM_ref_sup8:
+        value.addr = r.getuint(8);
+        break;
+
+    case DW_FORM_ref_sup4:
+        value.addr = r.getu32();
+        break;
+
+    case DW_FORM_strp_sup:
+    case DW_FORM_line_strp:
+        value.addr = r.getuint(dwarfLen);
+        break;
+
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+        value.udata = r.getuleb128();
+        break;
+
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+        value.udata = r.getu8();
+        break;
+
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+        value.udata = r.getu16();
+        break;
+
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+        value.udata = r.getuint(3);
+        break;
+
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+        value.udata = r.getu32();
+        break;
+
+    case DW_FORM_data16:
+        blocks.emplace_back();
+        value.block = &blocks.back();
+        value.block->length = 16;
+        value.block->offset = r.getOffset();
+        r.skip(16);
         break;
 
     default:
@@ -647,77 +1635,96 @@ RawDIE::readValue(DWARFReader &r, Form form, Value &value, const Unit *unit)
     }
 }
 
-RawDIE::~RawDIE()
-{
-    int i = 0;
-    for (auto form : type->forms) {
-        switch (form) {
-            case DW_FORM_exprloc:
-            case DW_FORM_block:
-            case DW_FORM_block1:
-            case DW_FORM_block2:
-            case DW_FORM_block4:
-                delete values[i].block;
-                break;
-            default:
-                break;
-        }
-        ++i;
-    }
-}
-
 const LineInfo *
 Unit::getLines()
 {
     if (lines != nullptr)
         return lines.get();
-    for (const auto &entry : topLevelDIEs()) {
-        if (entry.tag() == DW_TAG_partial_unit || entry.tag() == DW_TAG_compile_unit) {
-            if (dwarf->lineshdr) {
-                auto attr = entry.attribute(DW_AT_stmt_list);
-                if (!attr.valid())
-                    continue;
-                auto stmts = off_t(attr);
-                DWARFReader r2(dwarf->lineshdr, stmts);
-                lines.reset(new LineInfo());
-                lines->build(r2, this);
-                return lines.get();
-            }
-        }
-    }
-    return nullptr;
+    if (!dwarf->lineshdr)
+        return nullptr;
+    DWARFReader r(io, entriesOffset, end);
+    auto root = rootEntry(r);
+    if (root == nullptr || (root->tag != DW_TAG_partial_unit && root->tag != DW_TAG_compile_unit))
+        return nullptr;
+    Form form;
+    Value value;
+    if (!readAttribute(r, *root, DW_AT_stmt_list, form, value))
+        return nullptr;
+    DWARFReader r2(dwarf->lineshdr, value.addr);
+    lines.reset(new LineInfo());
+    lines->build(r2, this);
+    return lines.get();
 }
 
-RawDIE::RawDIE(DWARFReader &r, size_t abbrev, Unit *unit)
-    : type(unit->findAbbreviation(abbrev))
-    , values(type->forms.size())
+const Abbreviation *
+Unit::findAbbreviation(size_t code) const
 {
-    size_t i = 0;
-    for (auto form : type->forms)
-        readValue(r, form, values[i++], unit);
-    if (type->hasChildren)
-        unit->decodeEntries(r, children);
+    return abbreviations->find(code);
 }
 
-const Abbreviation *
-Unit::findAbbreviation(size_t offset) const
+/*
+ * Decode a value of a fixed-size form from "data", returning its size.
+ */
+static size_t
+decodeFixed(Form form, const unsigned char *data, const UnitFormat &format, Value &value)
 {
-    auto it = abbreviations.find(offset);
-    return it != abbreviations.end() ? &it->second : nullptr;
+    size_t size = fixedFormSize(form, format);
+    switch (form) {
+    case DW_FORM_flag_present:
+        value.flag = true;
+        break;
+    case DW_FORM_flag:
+        value.flag = data[0] != 0;
+        break;
+    default:
+        value.udata = 0;
+        for (size_t i = size; i-- > 0;)
+            value.udata = value.udata << 8 | data[i];
+        break;
+    }
+    return size;
 }
 
+/*
+ * Decode a list of sibling DIEs (and, recursively, their children) into the
+ * unit's flat storage. Runs of fixed-size attributes in the abbreviation's
+ * plan are read from the section in one go.
+ */
 void
-Unit::decodeEntries(DWARFReader &r, Entries &entries)
+Unit::decodeEntries(DWARFReader &r) const
 {
     while (!r.empty()) {
-        intmax_t offset = r.getOffset();
-        size_t abbrev = r.getuleb128();
-        if (abbrev == 0)
+        Elf::Off entryOffset = r.getOffset();
+        size_t code = r.getuleb128();
+        if (code == 0)
             return;
-        allEntries.emplace(std::piecewise_construct,
-                        std::forward_as_tuple(offset),
-                        std::forward_as_tuple(r, abbrev, this));
-        entries.push_back(offset);
+        auto type = findAbbreviation(code);
+        if (type == nullptr)
+            throw (Exception() << "no abbreviation " << code << " for DIE at offset "
+                  << entryOffset << " in " << *io);
+        size_t idx = entries.size();
+        size_t firstValue = values.size();
+        entries.push_back(RawDIE{ type, uint32_t(firstValue), 0 });
+        entryOffsets.push_back(entryOffset - offset);
+        values.resize(firstValue + type->forms.size());
+        for (const auto &step : type->plan) {
+            unsigned char data[256];
+            if (step.type == PLAN_FIXED && step.size <= sizeof data) {
+                r.io->readObj(r.getOffset(), data, step.size);
+                r.skip(step.size);
+                const unsigned char *p = data;
+                for (size_t i = step.first; i < size_t(step.first + step.count); ++i)
+                    p += decodeFixed(type->forms[i], p, format, values[firstValue + i]);
+            } else if (step.type == PLAN_CONST) {
+                values[firstValue + step.first].sdata = type->constants[step.first];
+            } else {
+                for (size_t i = step.first; i < size_t(step.first + step.count); ++i)
+                    readValue(r, type->forms[i], values[firstValue + i]);
+            }
+        }
+        if (type->hasChildren)
+            decodeEntries(r);
+        entries[idx].sibling = entries.size();
     }
 }
 
@@ -815,7 +1822,7 @@ DWARFReader::getlength(size_t *addrLen)
 }
 
 Elf::Off
-CFI::decodeCIEFDEHdr(DWARFReader &r, enum FIType type, Elf::Off *cieOff)
+CFI::decodeCIEFDEHdr(DWARFReader &r, enum FIType type, Elf::Off *cieOff) const
 {
     size_t addrLen;
     Elf::Off length = r.getlength(&addrLen);
@@ -831,89 +1838,634 @@ CFI::decodeCIEFDEHdr(DWARFReader &r, enum FIType type, Elf::Off *cieOff)
 }
 
 bool
-CFI::isCIE(Elf::Addr cieid)
+CFI::isCIE(Elf::Addr cieid) const
 {
     return (type == FI_DEBUG_FRAME && cieid == 0xffffffff) || (type == FI_EH_FRAME && cieid == 0);
 }
 
-CFI::CFI(Info *info, const Elf::Section& section, enum FIType type_)
+CFI::CFI(const Info *info, const Elf::Section& section, enum FIType type_, const Elf::Section &hdrSection)
     : dwarf(info)
     , sectionAddr(section.shdr.sh_addr)
     , io(section.io)
     , type(type_)
+    , hdrAddr(0)
+    , hdrTable(0)
+    , hdrCount(0)
+    , fdesIndexed(false)
+{
+    if (hdrSection && !readHeader(hdrSection))
+        std::clog << "ignoring unusable .eh_frame_hdr in " << *io << std::endl;
+}
+
+/*
+ * Decode a value from .eh_frame_hdr. "base" is the address of the header.
+ */
+static Elf::Addr
+decodeHeaderValue(DWARFReader &r, int encoding, Elf::Addr base)
+{
+    Elf::Addr pc = base + r.getOffset();
+    Elf::Addr value;
+    switch (encoding & 0xf) {
+        case DW_EH_PE_absptr: value = r.getuint(sizeof (Elf::Addr)); break;
+        case DW_EH_PE_udata2: value = r.getuint(2); break;
+        case DW_EH_PE_udata4: value = r.getuint(4); break;
+        case DW_EH_PE_udata8: value = r.getuint(8); break;
+        case DW_EH_PE_sdata2: value = r.getint(2); break;
+        case DW_EH_PE_sdata4: value = r.getint(4); break;
+        case DW_EH_PE_sdata8: value = r.getint(8); break;
+        case DW_EH_PE_uleb128: value = r.getuleb128(); break;
+        case DW_EH_PE_sleb128: value = r.getsleb128(); break;
+        default: throw (Exception() << "unsupported encoding " << encoding << " in .eh_frame_hdr");
+    }
+    switch (encoding & 0x70) {
+        case DW_EH_PE_absptr: break;
+        case DW_EH_PE_pcrel: value += pc; break;
+        case DW_EH_PE_datarel: value += base; break;
+        default: throw (Exception() << "unsupported encoding " << encoding << " in .eh_frame_hdr");
+    }
+    return value;
+}
+
+/*
+ * Check the .eh_frame_hdr describes our .eh_frame, and has a search table
+ * we can use directly.
+ */
+bool
+CFI::readHeader(const Elf::Section &hdrSection)
+{
+    DWARFReader r(hdrSection.io);
+    auto version = r.getu8();
+    auto framePtrEncoding = r.getu8();
+    auto countEncoding = r.getu8();
+    auto tableEncoding = r.getu8();
+    if (version != 1 || framePtrEncoding == DW_EH_PE_omit || countEncoding == DW_EH_PE_omit)
+        return false;
+    Elf::Addr base = hdrSection.shdr.sh_addr;
+    if (decodeHeaderValue(r, framePtrEncoding, base) != sectionAddr)
+        return false;
+    auto count = decodeHeaderValue(r, countEncoding, base);
+    // This is what every linker generates. Anything else gets a sorted index.
+    if (tableEncoding != (DW_EH_PE_datarel | DW_EH_PE_sdata4))
+        return false;
+    hdr = hdrSection.io;
+    hdrAddr = base;
+    hdrTable = r.getOffset();
+    hdrCount = count;
+    return true;
+}
+
+/*
+ * Without an .eh_frame_hdr, build a sorted index of the FDEs. We need only
+ * decode the initial location of each, (and the CIEs they use.)
+ */
+void
+CFI::indexFDEs() const
 {
     DWARFReader reader(io);
+    for (Elf::Off nextoff; !reader.empty();  reader.setOffset(nextoff)) {
+        Elf::Off startOffset = reader.getOffset();
+        Elf::Off associatedCIE;
+        nextoff = decodeCIEFDEHdr(reader, type, &associatedCIE);
+        if (nextoff == 0)
+            break;
+        if (associatedCIE == Elf::Off(-1))
+            continue;
+        const auto &cie = getCIE(associatedCIE);
+        fdeIndex.emplace_back(decodeAddress(reader, cie.addressEncoding), startOffset);
+    }
+    std::stable_sort(fdeIndex.begin(), fdeIndex.end(),
+          [] (const std::pair<Elf::Addr, Elf::Off> &l, const std::pair<Elf::Addr, Elf::Off> &r) {
+              return l.first < r.first; });
+    fdesIndexed = true;
+}
+
+size_t
+CFI::indexSize() const
+{
+    if (hdr)
+        return hdrCount;
+    if (!fdesIndexed) {
+        std::lock_guard<std::recursive_mutex> guard(lock);
+        if (!fdesIndexed)
+            indexFDEs();
+    }
+    return fdeIndex.size();
+}
+
+std::pair<Elf::Addr, Elf::Off>
+CFI::indexEntry(size_t i) const
+{
+    if (!hdr)
+        return fdeIndex[i];
+    DWARFReader r(hdr, hdrTable + i * 8);
+    Elf::Addr loc = hdrAddr + r.getint(4);
+    Elf::Addr fde = hdrAddr + r.getint(4);
+    return std::make_pair(loc, fde - sectionAddr);
+}
+
+const CIE &
+CFI::getCIE(Elf::Off offset) const
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    auto it = cies.find(offset);
+    if (it != cies.end())
+        return it->second;
+    DWARFReader reader(io, offset);
+    Elf::Off associatedCIE;
+    Elf::Off end = decodeCIEFDEHdr(reader, type, &associatedCIE);
+    if (end == 0 || associatedCIE != Elf::Off(-1))
+        throw (Exception() << "no CIE at offset " << offset << " in " << *io);
+    return cies.emplace(std::piecewise_construct,
+          std::forward_as_tuple(offset),
+          std::forward_as_tuple(this, reader, end)).first->second;
+}
+
+const FDE &
+CFI::getFDE(Elf::Off offset) const
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    auto it = fdes.find(offset);
+    if (it != fdes.end())
+        return it->second;
+    DWARFReader reader(io, offset);
+    Elf::Off associatedCIE;
+    Elf::Off end = decodeCIEFDEHdr(reader, type, &associatedCIE);
+    if (end == 0 || associatedCIE == Elf::Off(-1))
+        throw (Exception() << "no FDE at offset " << offset << " in " << *io);
+    return fdes.emplace(std::piecewise_construct,
+          std::forward_as_tuple(offset),
+          std::forward_as_tuple(this, reader, associatedCIE, end)).first->second;
+}
 
-    // decode in 2 passes: first for CIE, then for FDE
-    off_t nextoff;
-    for (; !reader.empty();  reader.setOffset(nextoff)) {
-        size_t startOffset = reader.getOffset();
+void
+CFI::decodeAll() const
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    DWARFReader reader(io);
+    for (Elf::Off nextoff; !reader.empty();  reader.setOffset(nextoff)) {
+        Elf::Off startOffset = reader.getOffset();
         Elf::Off associatedCIE;
         nextoff = decodeCIEFDEHdr(reader, type, &associatedCIE);
         if (nextoff == 0)
             break;
+        if (associatedCIE == Elf::Off(-1))
+            getCIE(startOffset);
+        else
+            getFDE(startOffset);
+    }
+}
 
-        auto ensureCIE = [this, &reader, nextoff] (Elf::Off offset) {
-            // This is in fact a CIE - add it in if we have not seen it yet.
-            if (cies.find(offset) != cies.end())
-                return;
-            cies.emplace(std::piecewise_construct,
-                        std::forward_as_tuple(offset),
-                        std::forward_as_tuple(this, reader, nextoff));
-        };
+size_t
+CFI::memoryUsed() const
+{
+    // Allow for the map nodes' pointers and colour.
+    const size_t nodeOverhead = 4 * sizeof (void *);
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    size_t total = sizeof *this
+        + cies.size() * (sizeof (CIE) + nodeOverhead)
+        + fdeIndex.capacity() * sizeof fdeIndex[0];
+    for (auto &fde : fdes)
+        total += sizeof fde + nodeOverhead
+            + fde.second.rows.capacity() * sizeof fde.second.rows[0]
+            + fde.second.rules.capacity() * sizeof fde.second.rules[0];
+    return total;
+}
 
-        if (associatedCIE == Elf::Off(-1)) {
-            ensureCIE(startOffset);
-        } else {
-            // Make sure we have the associated CIE.
-            ensureCIE(associatedCIE);
-            fdeList.emplace_back(this, reader, associatedCIE, nextoff);
-        }
+/*
+ * Find the unwind rules for "addr" in an FDE, executing its instructions
+ * to build the FDE's row table the first time we look at it.
+ */
+const UnwindRow *
+CFI::findRow(const FDE &fde, Elf::Addr addr) const
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    if (fde.rows.empty()) {
+        DWARFReader r(io, fde.instructions, fde.end);
+        getCIE(fde.cieOff).execInsns(r, fde.iloc, fde.iloc + fde.irange, &fde);
     }
+    auto row = std::upper_bound(fde.rows.begin(), fde.rows.end(), addr,
+          [] (Elf::Addr lhs, const UnwindRow &rhs) { return lhs < rhs.start; });
+    return row == fde.rows.begin() ? nullptr : &*--row;
 }
 
 const FDE *
 CFI::findFDE(Elf::Addr addr) const
 {
-    for (const auto &fde : fdeList) {
-        // XXX: addr can be just past last instruction in function
-        if (fde.iloc <= addr && fde.iloc + fde.irange >= addr)
-            return &fde;
+    // Find the last FDE starting at or before addr, and the first of any
+    // others starting at the same address.
+    size_t lo = 0, hi = indexSize();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (indexEntry(mid).first <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    if (lo == 0)
+        return nullptr;
+    auto entry = indexEntry(--lo);
+    while (lo != 0 && indexEntry(lo - 1).first == entry.first)
+        entry = indexEntry(--lo);
+
+    // XXX: addr can be just past last instruction in function, so prefer the
+    // preceding FDE if it ends exactly at addr.
+    if (entry.first == addr && lo != 0) {
+        const auto &prev = getFDE(indexEntry(lo - 1).second);
+        if (prev.iloc <= addr && prev.iloc + prev.irange >= addr)
+            return &prev;
+    }
+    const auto &fde = getFDE(entry.second);
+    if (fde.iloc <= addr && fde.iloc + fde.irange >= addr)
+        return &fde;
     return nullptr;
 }
 
-std::vector<std::pair<string, int>>
-Info::sourceFromAddr(uintmax_t addr)
+void
+Info::indexUnits() const
 {
-    std::vector<std::pair<string, int>> info;
-    std::list<Unit::sptr> units;
-
-    if (hasRanges()) {
-        auto &rangelist = ranges();
-        for (auto &rs : rangelist) {
-            for (auto &r : rs.ranges) {
-                if (r.start <= addr && r.start + r.length > addr) {
-                    units.push_back(getUnit(rs.debugInfoOffset));
+    unitsIndexed = true;
+    std::vector<UnitRange> all;
+    std::set<Elf::Off> described;
+    for (const auto &set : ranges()) {
+        described.insert(set.debugInfoOffset);
+        for (const auto &range : set.ranges)
+            if (range.length != 0)
+                all.push_back(UnitRange{ range.start, range.start + range.length,
+                      set.debugInfoOffset });
+    }
+
+    // Without .debug_aranges, .gdb_index may have an address table.
+    auto index = described.empty() ? nameIndex() : nullptr;
+    if (index != nullptr) {
+        size_t first = all.size();
+        if (index->unitRanges(all)) {
+            for (size_t i = first; i < all.size(); ++i)
+                described.insert(all[i].unit);
+            if (verbose >= 2)
+                *debug << "found " << all.size() - first << " unit ranges in .gdb_index of "
+                    << *io << std::endl;
+        }
+    }
+
+    // Synthesize ranges from the root DIEs of units .debug_aranges doesn't
+    // cover. This only needs the unit headers and the root DIEs.
+    for (const auto &unit : getUnits()) {
+        if (described.find(unit->offset) != described.end())
+            continue;
+        DWARFReader r(unit->io);
+        auto root = unit->rootEntry(r);
+        RangeList rootRanges;
+        if (root == nullptr || !unit->entryRanges(r, *root, rootRanges)) {
+            unrangedUnits.push_back(unit->offset);
+            continue;
+        }
+        for (const auto &range : rootRanges)
+            if (range.first < range.second)
+                all.push_back(UnitRange{ range.first, range.second, Elf::Off(unit->offset) });
+    }
+
+    // Sort, and trim any overlaps, so the earlier range keeps the addresses.
+    std::stable_sort(all.begin(), all.end(),
+            [](const UnitRange &l, const UnitRange &r) { return l.start < r.start; });
+    for (auto &range : all) {
+        if (!unitRanges.empty() && unitRanges.back().end > range.start) {
+            range.start = unitRanges.back().end;
+            if (range.start >= range.end)
+                continue;
+        }
+        unitRanges.push_back(range);
+    }
+    if (verbose >= 2)
+        *debug << "indexed " << unitRanges.size() << " unit ranges, "
+            << unrangedUnits.size() << " units without ranges for " << *io << std::endl;
+}
+
+/*
+ * Find the units that may describe an address: either the unit whose range
+ * covers it, or failing that, any units we know nothing about.
+ */
+std::vector<Unit::sptr>
+Info::unitsForAddr(Elf::Addr addr) const
+{
+    if (!unitsIndexed)
+        indexUnits();
+    std::vector<Unit::sptr> units;
+    auto it = std::upper_bound(unitRanges.begin(), unitRanges.end(), addr,
+            [](Elf::Addr addr, const UnitRange &range) { return addr < range.start; });
+    if (it != unitRanges.begin() && addr < (--it)->end) {
+        units.push_back(getUnit(it->unit));
+    } else {
+        for (auto offset : unrangedUnits)
+            units.push_back(getUnit(offset));
+    }
+    return units;
+}
+
+const NameIndex *
+Info::nameIndex() const
+{
+    if (!namesLoaded) {
+        namesLoaded = true;
+        try {
+            auto &debugNames = elf->getSection(".debug_names", SHT_PROGBITS);
+            auto &gdbIndex = elf->getSection(".gdb_index", SHT_PROGBITS);
+            if (debugNames)
+                names = make_unique<DebugNames>(debugNames.io, debugStrings);
+            else if (gdbIndex)
+                names = make_unique<GdbIndex>(gdbIndex.io);
+        }
+        catch (const Exception &ex) {
+            std::clog << "can't decode accelerator table for " << *elf->io << ": " << ex.what() << "\n";
+        }
+    }
+    return names.get();
+}
+
+/*
+ * Find the DIEs named "name" in a list of siblings, looking inside
+ * namespaces and types, but not functions.
+ */
+static void
+findNamed(const DIEList &list, const string &name, std::vector<DIE> &found)
+{
+    for (const auto &die : list) {
+        switch (die.tag()) {
+            case DW_TAG_compile_unit:
+            case DW_TAG_partial_unit:
+                findNamed(die.children(), name, found);
+                break;
+            case DW_TAG_namespace:
+            case DW_TAG_class_type:
+            case DW_TAG_structure_type:
+            case DW_TAG_union_type:
+                if (die.name() == name)
+                    found.push_back(die);
+                findNamed(die.children(), name, found);
+                break;
+            default:
+                if (die.name() == name)
+                    found.push_back(die);
+                break;
+        }
+    }
+}
+
+std::vector<DIE>
+Info::findNames(const string &name) const
+{
+    std::vector<DIE> dies;
+    auto index = nameIndex();
+    if (index == nullptr)
+        return dies;
+    std::vector<NameEntry> entries;
+    index->findName(name, entries);
+    std::set<Elf::Off> searched;
+    for (const auto &entry : entries) {
+        auto unit = getUnit(entry.unit);
+        if (unit == nullptr)
+            continue;
+        if (entry.die != 0) {
+            auto die = unit->offsetToDIE(entry.die);
+            if (die)
+                dies.push_back(die);
+        } else if (searched.insert(entry.unit).second) {
+            // We only know the unit: search it for the unqualified name.
+            auto sep = name.rfind("::");
+            findNamed(unit->topLevelDIEs(), sep == string::npos ? name : name.substr(sep + 2), dies);
+        }
+    }
+    return dies;
+}
+
+/*
+ * The hash of a name in .debug_names: the DJB hash of the case-folded name.
+ */
+static uint32_t
+debugNamesHash(const string &name)
+{
+    uint32_t hash = 5381;
+    for (unsigned char c : name)
+        hash = hash * 33 + tolower(c);
+    return hash;
+}
+
+DebugNames::DebugNames(Reader::csptr io_, Reader::csptr strings_)
+    : io(std::move(io_))
+    , strings(std::move(strings_))
+{
+    DWARFReader r(io);
+    while (!r.empty()) {
+        Index index;
+        index.offset = r.getOffset();
+        Elf::Off length = r.getlength(&index.dwarfLen);
+        if (length == 0)
+            break;
+        Elf::Off next = r.getOffset() + length;
+        auto version = r.getu16();
+        if (version != 5) {
+            if (verbose > 0)
+                *debug << "skipping version " << version << " name index in " << *io << std::endl;
+            r.setOffset(next);
+            continue;
+        }
+        r.getu16(); // padding.
+        uint32_t unitCount = r.getu32();
+        uint32_t localTypeUnits = r.getu32();
+        uint32_t foreignTypeUnits = r.getu32();
+        index.bucketCount = r.getu32();
+        index.nameCount = r.getu32();
+        uint32_t abbrevSize = r.getu32();
+        r.skip(r.getu32()); // augmentation string.
+        for (uint32_t i = 0; i < unitCount; ++i)
+            index.units.push_back(r.getuint(index.dwarfLen));
+        r.skip(localTypeUnits * index.dwarfLen + foreignTypeUnits * 8);
+        index.buckets = r.getOffset();
+        r.skip(index.bucketCount * 4);
+        index.hashes = r.getOffset();
+        r.skip(index.bucketCount != 0 ? index.nameCount * 4 : 0);
+        index.stringOffsets = r.getOffset();
+        r.skip(index.nameCount * index.dwarfLen);
+        index.entryOffsets = r.getOffset();
+        r.skip(index.nameCount * index.dwarfLen);
+        index.entryPool = r.getOffset() + abbrevSize;
+        for (uintmax_t code; (code = r.getuleb128()) != 0; ) {
+            auto &attrs = index.abbrevs[code];
+            r.getuleb128(); // tag
+            for (;;) {
+                auto idx = r.getuleb128();
+                auto form = Form(r.getuleb128());
+                if (idx == 0 && form == 0)
                     break;
-                }
+                attrs.emplace_back(idx, form);
             }
         }
+        indexes.push_back(std::move(index));
+        r.setOffset(next);
     }
-    if (units.empty())
-        units = getUnits();
-    for (const auto &unit : units) {
-        auto lines = unit->getLines();
-        if (lines) {
-            for (auto i = lines->matrix.begin(); i != lines->matrix.end(); ++i) {
-                if (i->end_sequence)
-                    continue;
-                auto next = i+1;
-                if (i->addr <= addr && next->addr > addr)
-                    info.emplace_back(i->file->name, i->line);
+}
+
+void
+DebugNames::readEntries(const Index &index, Elf::Off offset, std::vector<NameEntry> &found) const
+{
+    enum { DW_IDX_compile_unit = 1, DW_IDX_type_unit, DW_IDX_die_offset };
+    DWARFReader r(io, offset);
+    for (uintmax_t code; (code = r.getuleb128()) != 0; ) {
+        auto abbrev = index.abbrevs.find(code);
+        if (abbrev == index.abbrevs.end())
+            throw (Exception() << "no abbreviation " << code << " for name entry at offset "
+                  << offset << " in " << *io);
+        uintmax_t unit = 0, die = 0;
+        bool typeUnit = false;
+        for (const auto &attr : abbrev->second) {
+            uintmax_t value;
+            switch (attr.second) {
+                case DW_FORM_flag_present: value = 1; break;
+                case DW_FORM_data1: case DW_FORM_ref1: case DW_FORM_flag: value = r.getu8(); break;
+                case DW_FORM_data2: case DW_FORM_ref2: value = r.getu16(); break;
+                case DW_FORM_data4: case DW_FORM_ref4: value = r.getu32(); break;
+                case DW_FORM_data8: case DW_FORM_ref8: case DW_FORM_ref_sig8: value = r.getuint(8); break;
+                case DW_FORM_udata: case DW_FORM_ref_udata: value = r.getuleb128(); break;
+                default:
+                    throw (Exception() << "unsupported form " << int(attr.second)
+                          << " in name index of " << *io);
             }
+            switch (attr.first) {
+                case DW_IDX_compile_unit: unit = value; break;
+                case DW_IDX_type_unit: typeUnit = true; break;
+                case DW_IDX_die_offset: die = value; break;
+                default: break;
+            }
+        }
+        if (typeUnit || unit >= index.units.size())
+            continue;
+        found.push_back(NameEntry{ index.units[unit], die != 0 ? index.units[unit] + die : 0 });
+    }
+}
+
+void
+DebugNames::findName(const string &name, std::vector<NameEntry> &found) const
+{
+    uint32_t hash = debugNamesHash(name);
+    for (const auto &index : indexes) {
+        auto nameAt = [this, &index](uint32_t i) {
+            DWARFReader r(io, index.stringOffsets + i * index.dwarfLen);
+            return strings ? strings->readString(r.getuint(index.dwarfLen)) : "";
+        };
+        auto entriesAt = [this, &index, &found](uint32_t i) {
+            DWARFReader r(io, index.entryOffsets + i * index.dwarfLen);
+            readEntries(index, index.entryPool + r.getuint(index.dwarfLen), found);
+        };
+        if (index.bucketCount == 0) {
+            // No hash table - we have to look at each name.
+            for (uint32_t i = 0; i < index.nameCount; ++i)
+                if (nameAt(i) == name)
+                    entriesAt(i);
+            continue;
+        }
+        uint32_t bucket = hash % index.bucketCount;
+        DWARFReader r(io, index.buckets + bucket * 4);
+        uint32_t first = r.getu32(); // 1-based index of first name in bucket.
+        if (first == 0)
+            continue;
+        DWARFReader hashes(io, index.hashes + (first - 1) * 4);
+        for (uint32_t i = first - 1; i < index.nameCount; ++i) {
+            uint32_t nameHash = hashes.getu32();
+            if (nameHash % index.bucketCount != bucket)
+                break;
+            if (nameHash == hash && nameAt(i) == name)
+                entriesAt(i);
+        }
+    }
+}
+
+/*
+ * The hash used for the symbol table in .gdb_index.
+ */
+static uint32_t
+gdbIndexHash(const string &name)
+{
+    uint32_t hash = 0;
+    for (unsigned char c : name)
+        hash = hash * 67 + tolower(c) - 113;
+    return hash;
+}
+
+GdbIndex::GdbIndex(Reader::csptr io_)
+    : io(std::move(io_))
+{
+    DWARFReader r(io);
+    version = r.getu32();
+    if (version < 7 || version > 8)
+        throw (Exception() << "unsupported .gdb_index version " << version);
+    Elf::Off unitList = r.getu32();
+    Elf::Off typeUnitList = r.getu32();
+    addressArea = r.getu32();
+    symbolTable = r.getu32();
+    constantPool = r.getu32();
+    addressEnd = symbolTable;
+    symbolSlots = (constantPool - symbolTable) / 8;
+    for (DWARFReader units(io, unitList, typeUnitList); !units.empty(); ) {
+        this->units.push_back(units.getuint(8));
+        units.getuint(8); // length.
+    }
+}
+
+void
+GdbIndex::findName(const string &name, std::vector<NameEntry> &found) const
+{
+    if (symbolSlots == 0)
+        return;
+    uint32_t hash = gdbIndexHash(name);
+    uint32_t mask = symbolSlots - 1;
+    uint32_t step = ((hash * 17) & mask) | 1;
+    uint32_t slot = hash & mask;
+    for (uint32_t probes = 0; probes < symbolSlots; ++probes, slot = (slot + step) & mask) {
+        DWARFReader r(io, symbolTable + slot * 8);
+        uint32_t nameOffset = r.getu32();
+        uint32_t vectorOffset = r.getu32();
+        if (nameOffset == 0 && vectorOffset == 0)
+            return;
+        if (io->readString(constantPool + nameOffset) != name)
+            continue;
+        // The CU vector: low 24 bits of each entry are the unit index.
+        // Indexes past the compilation units refer to type units.
+        DWARFReader cus(io, constantPool + vectorOffset);
+        for (auto count = cus.getu32(); count != 0; --count) {
+            uint32_t unit = cus.getu32() & 0xffffff;
+            if (unit < units.size())
+                found.push_back(NameEntry{ units[unit], 0 });
         }
+        return;
+    }
+}
+
+bool
+GdbIndex::unitRanges(std::vector<UnitRange> &ranges) const
+{
+    for (DWARFReader r(io, addressArea, addressEnd); r.getLimit() - r.getOffset() >= 20; ) {
+        Elf::Addr low = r.getuint(8);
+        Elf::Addr high = r.getuint(8);
+        uint32_t unit = r.getu32();
+        if (unit < units.size() && low < high)
+            ranges.push_back(UnitRange{ low, high, units[unit] });
+    }
+    return true;
+}
 
+std::vector<std::pair<string, int>>
+Info::sourceFromAddr(uintmax_t addr)
+{
+    std::vector<std::pair<string, int>> info;
+    std::vector<const LineRow *> rows;
+    for (const auto &unit : unitsForAddr(addr)) {
+        auto lines = unit->getLines();
+        if (lines) {
+            rows.clear();
+            lines->find(addr, rows);
+            for (auto row : rows)
+                info.emplace_back(row->file < lines->files.size()
+                      ? lines->files[row->file].name : "unknown", row->line);
+        }
     }
     return info;
 }
@@ -924,6 +2476,8 @@ CallFrame::CallFrame()
 {
     cfaReg = 0;
     cfaValue.type = UNDEF;
+    for (auto &reg : registers)
+        reg.type = UNDEF;
 #define REGMAP(number, field) registers[number].type = SAME;
 #include "libpstack/dwarf/archreg.h"
 #undef REGMAP
@@ -932,41 +2486,123 @@ CallFrame::CallFrame()
 #endif
 }
 
+/*
+ * Rows can use the fast path in StackFrame::unwind if they have only simple
+ * rules for the CFA and registers.
+ */
+static bool
+isSimple(const CallFrame &frame)
+{
+    if (frame.cfaValue.type != OFFSET)
+        return false;
+    for (const auto &reg : frame.registers) {
+        switch (reg.type) {
+            case UNDEF: case SAME: case OFFSET: case ARCH:
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool
+sameRule(const RegisterUnwind &l, const RegisterUnwind &r)
+{
+    if (l.type != r.type)
+        return false;
+    switch (l.type) {
+        case OFFSET: case VAL_OFFSET:
+            return l.u.offset == r.u.offset;
+        case REG:
+            return l.u.reg == r.u.reg;
+        case EXPRESSION: case VAL_EXPRESSION:
+            return l.u.expression.offset == r.u.expression.offset
+                && l.u.expression.length == r.u.expression.length;
+        case ARCH:
+            return l.u.arch == r.u.arch;
+        default:
+            return true;
+    }
+}
+
+/*
+ * Add a row to an FDE's table for "frame", keeping only the rules that
+ * differ from our default frame.
+ */
+void
+CIE::addRow(const FDE &fde, Elf::Addr start, const CallFrame &frame) const
+{
+    auto firstRule = uint32_t(fde.rules.size());
+    for (int regno = 0; regno < MAXREG; ++regno)
+        if (!sameRule(frame.registers[regno], defaultFrame.registers[regno]))
+            fde.rules.push_back(RegisterRule{ regno, frame.registers[regno] });
+    fde.rows.push_back(UnwindRow{ start, frame.cfaReg, frame.cfaValue,
+          firstRule, uint32_t(fde.rules.size()), isSimple(frame) });
+}
+
+const RegisterUnwind &
+FDE::rule(const CIE &cie, const UnwindRow &row, int regno) const
+{
+    for (auto i = row.firstRule; i < row.lastRule; ++i)
+        if (rules[i].regno == regno)
+            return rules[i].unwind;
+    return cie.defaultFrame.registers[regno];
+}
+
+/*
+ * Execute the instructions in "r", starting at address "addr" with the CIE's
+ * default frame, until we pass "wantAddr", and return the resulting frame.
+ * If "rowsFor" is given, its table receives a row each time the address
+ * advances, and a final one for the state at the end of the instructions.
+ */
 CallFrame
-CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
+CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr, const FDE *rowsFor) const
 {
     std::stack<CallFrame> stack;
-    CallFrame frame;
+    const CallFrame &dframe = defaultFrame;
+    CallFrame frame = dframe;
 
     uintmax_t offset;
     int reg, reg2;
 
-    // default frame for this CIE.
-    CallFrame dframe;
-    if (addr != 0 || wantAddr != 0) {
-        DWARFReader r2(r.io, instructions, end);
-        dframe = execInsns(r2, 0, 0);
-        frame = dframe;
-    }
+    // Rules for registers we don't track are parsed, and then ignored.
+    RegisterUnwind ignored;
+    auto rule = [&frame, &ignored] (int regno) -> RegisterUnwind & {
+        return regno >= 0 && regno < MAXREG ? frame.registers[regno] : ignored;
+    };
+    auto restore = [&rule, &dframe] (int regno) {
+        if (regno >= 0 && regno < MAXREG)
+            rule(regno) = dframe.registers[regno];
+    };
+    auto advance = [this, &addr, &frame, rowsFor] (uintmax_t newAddr) {
+        if (rowsFor != nullptr && newAddr > addr)
+            addRow(*rowsFor, addr, frame);
+        addr = newAddr;
+    };
+
     while (addr <= wantAddr) {
-        if (r.empty())
+        if (r.empty()) {
+            if (rowsFor != nullptr)
+                addRow(*rowsFor, addr, frame);
             return frame;
+        }
         uint8_t rawOp = r.getu8();
         reg = rawOp &0x3f;
         auto op = CFAInstruction(rawOp & ~0x3f);
         switch (op) {
         case DW_CFA_advance_loc:
-            addr += reg * codeAlign;
+            advance(addr + reg * codeAlign);
             break;
 
         case DW_CFA_offset:
             offset = r.getuleb128();
-            frame.registers[reg].type = OFFSET;
-            frame.registers[reg].u.offset = offset * dataAlign;
+            rule(reg).type = OFFSET;
+            rule(reg).u.offset = offset * dataAlign;
             break;
 
         case DW_CFA_restore: {
-            frame.registers[reg] = dframe.registers[reg];
+            restore(reg);
             break;
         }
 
@@ -977,48 +2613,48 @@ CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
                 break;
 
             case DW_CFA_set_loc:
-                addr = r.getuint(r.addrLen);
+                advance(r.getuint(r.addrLen));
                 break;
 
             case DW_CFA_advance_loc1:
-                addr += r.getu8() * codeAlign;
+                advance(addr + r.getu8() * codeAlign);
                 break;
 
             case DW_CFA_advance_loc2:
-                addr += r.getu16() * codeAlign;
+                advance(addr + r.getu16() * codeAlign);
                 break;
 
             case DW_CFA_advance_loc4:
-                addr += r.getu32() * codeAlign;
+                advance(addr + r.getu32() * codeAlign);
                 break;
 
             case DW_CFA_offset_extended:
                 reg = r.getuleb128();
                 offset = r.getuleb128();
-                frame.registers[reg].type = OFFSET;
-                frame.registers[reg].u.offset = offset * dataAlign;
+                rule(reg).type = OFFSET;
+                rule(reg).u.offset = offset * dataAlign;
                 break;
 
             case DW_CFA_restore_extended:
                 reg = r.getuleb128();
-                frame.registers[reg] = dframe.registers[reg];
+                restore(reg);
                 break;
 
             case DW_CFA_undefined:
                 reg = r.getuleb128();
-                frame.registers[reg].type = UNDEF;
+                rule(reg).type = UNDEF;
                 break;
 
             case DW_CFA_same_value:
                 reg = r.getuleb128();
-                frame.registers[reg].type = SAME;
+                rule(reg).type = SAME;
                 break;
 
             case DW_CFA_register:
                 reg = r.getuleb128();
                 reg2 = r.getuleb128();
-                frame.registers[reg].type = REG;
-                frame.registers[reg].u.reg = reg2;
+                rule(reg).type = REG;
+                rule(reg).u.reg = reg2;
                 break;
 
             case DW_CFA_remember_state:
@@ -1059,7 +2695,7 @@ CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
 
             case DW_CFA_val_expression: {
                 reg = r.getuleb128();
-                auto &unwind = frame.registers[reg];
+                auto &unwind = rule(reg);
                 unwind.type = VAL_EXPRESSION;
                 unwind.u.expression.length = r.getuleb128();
                 unwind.u.expression.offset = r.getOffset();
@@ -1070,7 +2706,7 @@ CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
             case DW_CFA_expression: {
                 reg = r.getuleb128();
                 offset = r.getuleb128();
-                auto &unwind = frame.registers[reg];
+                auto &unwind = rule(reg);
                 unwind.type = EXPRESSION;
                 unwind.u.expression.offset = r.getOffset();
                 unwind.u.expression.length = offset;
@@ -1109,11 +2745,12 @@ CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
     return frame;
 }
 
-FDE::FDE(CFI *fi, DWARFReader &reader, Elf::Off cieOff_, Elf::Off endOff_)
+FDE::FDE(const CFI *fi, DWARFReader &reader, Elf::Off cieOff_, Elf::Off endOff_)
     : end(endOff_)
     , cieOff(cieOff_)
+    , framePointer(FP_UNKNOWN)
 {
-    auto &cie = fi->cies[cieOff];
+    auto &cie = fi->getCIE(cieOff);
     iloc = fi->decodeAddress(reader, cie.addressEncoding);
     irange = fi->decodeAddress(reader, cie.addressEncoding & 0xf);
     if (!cie.augmentation.empty() && cie.augmentation[0] == 'z') {
@@ -1184,6 +2821,11 @@ CIE::CIE(const CFI *fi, DWARFReader &r, Elf::Off end_)
         r.setOffset(endaugdata);
     }
     instructions = r.getOffset();
+
+    // Run the initial instructions once, for all FDEs using this CIE.
+    // (defaultFrame is still the architecture's default at this point.)
+    DWARFReader initial(r.io, instructions, end);
+    defaultFrame = execInsns(initial, 0, 0);
     r.setOffset(end);
 }
 
@@ -1205,6 +2847,8 @@ Attribute::operator DIE() const
         case DW_FORM_ref8:
             off = value().addr + dieref.unit->offset;
             break;
+        case DW_FORM_ref_sup4:
+        case DW_FORM_ref_sup8:
         case DW_FORM_GNU_ref_alt: {
             dwarf = dwarf->getAltDwarf().get();
             if (dwarf == nullptr)
@@ -1238,9 +2882,9 @@ Attribute::operator DIE() const
 Attribute
 DIE::attribute(AttrName name) const
 {
-    auto loc = die->type->attrName2Idx.find(name);
-    if (loc != die->type->attrName2Idx.end())
-        return Attribute(*this, &die->type->forms.at(loc->second));
+    int idx = die->type->attrIndex(name);
+    if (idx != -1)
+        return Attribute(*this, &die->type->forms[idx]);
 
     // If we have attributes of any of these types, we can look for other attributes in the referenced entry.
     static std::set<AttrName> derefs = {
@@ -1267,6 +2911,7 @@ ImageCache::getDwarf(const string &filename)
 Info::sptr
 ImageCache::getDwarf(Elf::Object::sptr object)
 {
+    std::lock_guard<std::recursive_mutex> guard(lock);
     auto it = dwarfCache.find(object);
     dwarfLookups++;
     if (it != dwarfCache.end()) {
@@ -1283,11 +2928,70 @@ ImageCache::ImageCache() : dwarfHits(0), dwarfLookups(0)
 {
 }
 
+/*
+ * An image's cost includes its DWARF, which can be much larger than the image
+ * once decoded. Dropping the image drops its DWARF, (see trim, below.)
+ */
+size_t
+ImageCache::memoryUsed(const Elf::Object::sptr &object)
+{
+    auto used = Elf::ImageCache::memoryUsed(object);
+    auto it = dwarfCache.find(object);
+    if (it != dwarfCache.end())
+        used += it->second->memoryUsed();
+    return used;
+}
+
+/*
+ * Trim the images, then drop the DWARF for any image that only we refer to:
+ * those evicted from the image cache, and those that were never in it, like
+ * the VDSOs of processes we've finished with.
+ */
+void
+ImageCache::trim(size_t limit)
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    Elf::ImageCache::trim(limit);
+    for (auto it = dwarfCache.begin(); it != dwarfCache.end(); ) {
+        // One reference is our key, and one is the Info's own.
+        if (it->first.use_count() <= 2)
+            it = dwarfCache.erase(it);
+        else
+            ++it;
+    }
+}
+
 ImageCache::~ImageCache() {
     if (verbose >= 2)
         *debug << "DWARF image cache: lookups: " << dwarfLookups << ", hits=" << dwarfHits << std::endl;
 }
 
+static bool
+contains(const DIE &parent, const DIE &die)
+{
+    if (parent.getOffset() == die.getOffset())
+        return true;
+    for (const auto &child : parent.children())
+        if (contains(child, die))
+            return true;
+    return false;
+}
+
+/*
+ * Kept for existing callers: this is now a lookup in the function index, and
+ * a check that what we found is within "entry".
+ */
+DIE
+findEntryForFunc(Elf::Addr address, const DIE &entry)
+{
+    if (!entry)
+        return DIE();
+    auto function = entry.getUnit()->dwarf->findFunction(address);
+    if (!function || function.getUnit() != entry.getUnit() || !contains(entry, function))
+        return DIE();
+    return function;
+}
+
 string
 typeName(const DIE &type)
 {
@@ -1326,86 +3030,211 @@ typeName(const DIE &type)
     }
 }
 
-DIE
-findEntryForFunc(Elf::Addr address, const DIE &entry)
+/*
+ * Collect the ranges of the subprograms in a list of sibling DIEs, and their
+ * descendents, without decoding the unit.
+ */
+static void
+collectFunctions(const Unit &unit, DWARFReader &r, std::vector<FunctionRange> &ranges)
 {
-    switch (entry.tag()) {
-        case DW_TAG_subprogram: {
-            Elf::Addr start, end;
-            auto low = entry.attribute(DW_AT_low_pc);
-            auto high = entry.attribute(DW_AT_high_pc);
-            if (low.valid() && high.valid()) {
-                switch (low.form()) {
-                    case DW_FORM_addr:
-                        start = uintmax_t(low);
-                        break;
-                    default:
-                        abort();
-                        break;
-                }
-                switch (high.form()) {
-                    case DW_FORM_addr:
-                        end = uintmax_t(high);
-                        break;
-                    case DW_FORM_data1:
-                    case DW_FORM_data2:
-                    case DW_FORM_data4:
-                    case DW_FORM_data8:
-                    case DW_FORM_udata:
-                        end = start + uintmax_t(high);
-                        break;
-                    default:
-                        abort();
-                }
-                if (start <= address && end >= address) // allow for the address to be one byte past the function
-                    return entry;
+    while (!r.empty()) {
+        Elf::Off offset = r.getOffset();
+        size_t code = r.getuleb128();
+        if (code == 0)
+            return;
+        auto type = unit.findAbbreviation(code);
+        if (type == nullptr)
+            throw (Exception() << "no abbreviation " << code << " for DIE at offset "
+                  << offset << " in " << *unit.io);
+        switch (type->tag) {
+            case DW_TAG_subprogram: {
+                // Functions split into hot and cold parts, (or otherwise
+                // non-contiguous), get an entry for each of their ranges.
+                RangeList entryRanges;
+                unit.entryRanges(r, *type, entryRanges);
+                for (const auto &range : entryRanges)
+                    if (range.first < range.second)
+                        ranges.push_back(FunctionRange{ range.first, range.second,
+                              Elf::Off(unit.offset), offset });
+                break;
             }
-            break;
+            // Types can't contain any code, and an inlined subroutine's
+            // range belongs to the subprogram it was inlined into.
+            case DW_TAG_array_type:
+            case DW_TAG_enumeration_type:
+            case DW_TAG_subroutine_type:
+            case DW_TAG_inlined_subroutine:
+                unit.skipEntry(r, *type);
+                continue;
+            default:
+                break;
         }
-        default:
-            for (auto child : entry.children()) {
-                auto descendent = findEntryForFunc(address, child);
-                if (descendent)
-                    return descendent;
+        unit.skipAttributes(r, *type);
+        if (type->hasChildren)
+            collectFunctions(unit, r, ranges);
+    }
+}
+
+void
+Info::indexFunctions() const
+{
+    functionsIndexed = true;
+    std::vector<FunctionRange> all;
+    for (const auto &unit : getUnits()) {
+        DWARFReader r(unit->io);
+        auto root = unit->rootEntry(r);
+        if (root == nullptr)
+            continue;
+        unit->skipAttributes(r, *root);
+        if (root->hasChildren)
+            collectFunctions(*unit, r, all);
+    }
+
+    // Order enclosing functions before those they contain. Where two
+    // functions have the same range, the first DIE is treated as the inner
+    // one, so it's the one we find.
+    std::sort(all.begin(), all.end(),
+            [](const FunctionRange &l, const FunctionRange &r) {
+                if (l.start != r.start)
+                    return l.start < r.start;
+                if (l.end != r.end)
+                    return l.end > r.end;
+                return l.die > r.die;
+            });
+
+    // Flatten the nesting: "open" holds the functions containing the current
+    // position, innermost last, and each span between changes to it is
+    // attributed to the innermost.
+    std::vector<const FunctionRange *> open;
+    Elf::Addr pos = 0;
+    auto emit = [this, &pos](const FunctionRange *range, Elf::Addr to) {
+        if (pos < to)
+            functions.push_back(FunctionRange{ pos, to, range->unit, range->die });
+        pos = std::max(pos, to);
+    };
+    for (const auto &range : all) {
+        while (!open.empty() && open.back()->end <= range.start) {
+            emit(open.back(), open.back()->end);
+            open.pop_back();
+        }
+        if (!open.empty())
+            emit(open.back(), range.start);
+        pos = range.start;
+        open.push_back(&range);
+    }
+    while (!open.empty()) {
+        emit(open.back(), open.back()->end);
+        open.pop_back();
+    }
+    if (verbose >= 2)
+        *debug << "indexed " << functions.size() << " function ranges for "
+            << *io << std::endl;
+}
+
+/*
+ * Find the subprogram containing an address. The address may also be just
+ * past the end of a function, (a return address after a call to a function
+ * that doesn't return, for example.)
+ */
+DIE
+Info::findFunction(Elf::Addr addr) const
+{
+    if (!functionsIndexed)
+        indexFunctions();
+    auto find = [this](Elf::Addr addr) -> const FunctionRange * {
+        auto it = std::upper_bound(functions.begin(), functions.end(), addr,
+                [](Elf::Addr addr, const FunctionRange &range) { return addr < range.start; });
+        if (it == functions.begin() || addr >= (--it)->end)
+            return nullptr;
+        return &*it;
+    };
+    auto range = find(addr);
+    if (range == nullptr && addr != 0)
+        range = find(addr - 1);
+    if (range == nullptr)
+        return DIE();
+    return getUnit(range->unit)->offsetToDIE(range->die);
+}
+
+static std::string
+demangle(const std::string &name)
+{
+    if (name.compare(0, 2, "_Z") != 0)
+        return "";
+    int status;
+    std::unique_ptr<char, void (*)(void *)> demangled(
+          abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status), free);
+    return status == 0 ? demangled.get() : "";
+}
+
+const Symbolization &
+Info::symbolize(Elf::Addr addr, bool withSource)
+{
+    std::lock_guard<std::mutex> guard(symbolsLock);
+    auto it = symbolizations.find(addr);
+    if (it == symbolizations.end()) {
+        Symbolization sym;
+        sym.function = findFunction(addr);
+        if (sym.function) {
+            auto lowpc = sym.function.attribute(DW_AT_low_pc);
+            if (lowpc.valid()) {
+                sym.haveOffset = true;
+                sym.offset = addr - uintmax_t(lowpc);
             }
-            break;
+        }
+        Elf::Sym elfSym;
+        sym.haveSymbol = elf->findSymbolByAddress(addr, STT_FUNC, elfSym, sym.symbol);
+        sym.symbolOffset = sym.haveSymbol ? addr - elfSym.st_value : addr;
+        sym.demangled = demangle(sym.symbol);
+        it = symbolizations.emplace(addr, std::move(sym)).first;
+    }
+    auto &sym = it->second;
+    if (withSource && !sym.haveSource) {
+        sym.source = sourceFromAddr(addr - 1);
+        sym.haveSource = true;
     }
-   return DIE();
+    return sym;
 }
 
 DIE
 DIEIter::operator *() const {
-    return u->offsetToDIE(*rawIter);
+    return u->entryAt(idx);
+}
+
+DIEIter &
+DIEIter::operator++() {
+    idx = u->entries[idx].sibling;
+    return *this;
 }
 
 DIEIter
 DIEList::begin() const {
-    return const_iterator(unit, dies.begin());
+    return const_iterator(unit, first);
 }
 
 DIEIter
 DIEList::end() const {
-    return const_iterator(unit, dies.end());
+    return const_iterator(unit, last);
 }
 
 std::pair<AttrName, Attribute>
 DIEAttributes::const_iterator::operator *() const {
     return std::make_pair(
-            rawIter->first,
-            Attribute(die, &die.die->type->forms[rawIter->second]));
+            die.die->type->names[idx],
+            Attribute(die, &die.die->type->forms[idx]));
 }
 
 DIEAttributes::const_iterator
 DIEAttributes::begin() const {
-    return const_iterator(die, die.die->type->attrName2Idx.begin());
+    return const_iterator(die, 0);
 }
 
 DIEAttributes::const_iterator
 DIEAttributes::end() const {
-    return const_iterator(die, die.die->type->attrName2Idx.end());
+    return const_iterator(die, die.die->type->forms.size());
 }
-const Value &Attribute::value() const { return dieref.die->values.at(formp - &dieref.die->type->forms[0]); }
+const Value &Attribute::value() const { return dieref.unit->values[dieref.die->firstValue + (formp - &dieref.die->type->forms[0])]; }
 Tag DIE::tag() const { return die->type->tag; }
 bool DIE::hasChildren() const { return die->type->hasChildren; }
-DIEList DIE::children() const { return DIEList(unit, die->children); }
+DIEList DIE::children() const { return DIEList(unit, die - &unit->entries[0] + 1, die->sibling); }
 }
@@ -3,6 +3,7 @@
 #include "libpstack/proc.h"
 
 #include <cassert>
+#include <cstring>
 #include <limits>
 #include <stack>
 
@@ -15,6 +16,25 @@ StackFrame::setCoreRegs(const Elf::CoreRegisters &sys)
 #undef REGMAP
 }
 
+/*
+ * Set what we can of the floating point and vector registers. DWARF numbers
+ * only the SSE registers, and we keep just the low 64 bits of each: enough
+ * for scalar float and double arguments.
+ */
+void
+StackFrame::setCoreFPRegs(const Elf::CoreFPRegisters &fp)
+{
+#ifdef SSEREG
+    for (int i = 0; i < SSEREGS; ++i) {
+        cpureg_t value;
+        memcpy(&value, &fp.xmm_space[i * 4], sizeof value);
+        setReg(SSEREG + i, value);
+    }
+#else
+    (void)fp;
+#endif
+}
+
 void
 StackFrame::getCoreRegs(Elf::CoreRegisters &core) const
 {
@@ -26,11 +46,11 @@ StackFrame::getCoreRegs(Elf::CoreRegisters &core) const
 void
 StackFrame::getFrameBase(const Process &p, intmax_t offset, ExpressionStack *stack) const
 {
-   Attribute attr;
    if (function) {
        auto base = function.attribute(DW_AT_frame_base);
        if (base.valid()) {
-           stack->push(stack->eval(p, attr, this, elfReloc) + offset);
+           ExpressionStack baseStack;
+           stack->push(baseStack.eval(p, base, this, elfReloc) + offset);
            return;
        }
    }
@@ -40,9 +60,18 @@ StackFrame::getFrameBase(const Process &p, intmax_t offset, ExpressionStack *sta
 Elf::Addr
 ExpressionStack::eval(const Process &proc, const Attribute &attr, const StackFrame *frame, Elf::Addr reloc)
 {
-    const Info *dwarf = attr.die().getUnit()->dwarf;
+    auto unit = attr.die().getUnit();
+    const Info *dwarf = unit->dwarf;
     switch (attr.form()) {
+        case DW_FORM_loclistx:
         case DW_FORM_sec_offset: {
+            if (unit->version >= 5) {
+                Block location;
+                if (!unit->locationList(attr.form(), attr.value(), frame->ip - reloc, location))
+                    return 0;
+                DWARFReader exr(dwarf->loclistsh, location.offset, location.offset + location.length);
+                return eval(proc, exr, frame, frame->elfReloc);
+            }
             auto &sec = dwarf->elf->getSection(".debug_loc", SHT_PROGBITS);
             auto objIp = frame->ip - reloc;
             // convert this object-relative addr to a unit-relative one
@@ -91,7 +120,7 @@ ExpressionStack::eval(const Process &proc, const Attribute &attr, const StackFra
             return eval(proc, r, frame, reloc);
         }
         default:
-            abort();
+            throw Exception() << "unsupported form " << attr.form() << " for DWARF expression";
     }
 }
 
@@ -267,7 +296,9 @@ ExpressionStack::eval(const Process &proc, DWARFReader &r, const StackFrame *fra
                 push(frame->getReg(op - DW_OP_reg0));
                 break;
             case DW_OP_regx:
-                push(frame->getReg(r.getsleb128()));
+                isReg = true;
+                inReg = r.getuleb128();
+                push(frame->getReg(inReg));
                 break;
 
             case DW_OP_entry_value:
@@ -290,11 +321,11 @@ ExpressionStack::eval(const Process &proc, DWARFReader &r, const StackFrame *fra
 }
 
 Elf::Addr
-StackFrame::getCFA(const Process &proc, const CallFrame &dcf) const
+StackFrame::getCFA(const Process &proc, const UnwindRow &row) const
 {
-    switch (dcf.cfaValue.type) {
+    switch (row.cfaValue.type) {
         case SAME:
-            return getReg(dcf.cfaReg);
+            return getReg(row.cfaReg);
         case VAL_OFFSET:
         case VAL_EXPRESSION:
         case REG:
@@ -304,11 +335,11 @@ StackFrame::getCFA(const Process &proc, const CallFrame &dcf) const
             break;
 
         case OFFSET:
-            return getReg(dcf.cfaReg) + dcf.cfaValue.u.offset;
+            return getReg(row.cfaReg) + row.cfaValue.u.offset;
         case EXPRESSION: {
             ExpressionStack stack;
-            auto start = dcf.cfaValue.u.expression.offset;
-            auto end = start + dcf.cfaValue.u.expression.length;
+            auto start = row.cfaValue.u.expression.offset;
+            auto end = start + row.cfaValue.u.expression.length;
             DWARFReader r(frameInfo->io, start, end);
             return stack.eval(proc, r, this, elfReloc);
         }
@@ -316,64 +347,76 @@ StackFrame::getCFA(const Process &proc, const CallFrame &dcf) const
     return -1;
 }
 
-StackFrame *
-StackFrame::unwind(Process &p)
+/*
+ * Find the image containing this frame's instruction pointer, and the FDE
+ * describing it, from either its debug frame information or eh_frame.
+ */
+void
+StackFrame::findCFI(Process &p)
 {
     elf = p.findObject(ip, &elfReloc);
     if (!elf)
         throw (Exception() << "no image for instruction address " << std::hex << ip);
-    Elf::Off objaddr = ip - elfReloc; // relocate process address to object address
-    // Try and find DWARF data with debug frame information, or an eh_frame section.
-        dwarf = p.getDwarf(elf);
+    dwarf = p.getDwarf(elf);
     if (dwarf) {
-        auto frames = { dwarf->debugFrame.get(), dwarf->ehFrame.get() };
-        for (auto f : frames) {
-            if (f != nullptr) {
-                fde = f->findFDE(objaddr);
-                if (fde != nullptr) {
-                    frameInfo = f;
-                    cie = &f->cies[fde->cieOff];
-                    break;
-                }
-            }
-        }
+        fde = dwarf->findFDE(ip - elfReloc, &frameInfo);
+        if (fde != nullptr)
+            cie = &frameInfo->getCIE(fde->cieOff);
     }
+}
+
+/*
+ * Unwind this frame, filling in "out" with the caller's. Returns false if
+ * there is no caller.
+ */
+bool
+StackFrame::unwind(Process &p, const Reader &stackMem, StackFrame &out)
+{
+    findCFI(p);
+    Elf::Off objaddr = ip - elfReloc; // relocate process address to object address
     if (fde == nullptr)
         throw (Exception() << "no FDE for instruction address " << std::hex << ip << " in " << *elf->io);
 
-    DWARFReader r(frameInfo->io, fde->instructions, fde->end);
-
-    auto iter = dwarf->callFrameForAddr.find(objaddr);
-    if (iter == dwarf->callFrameForAddr.end())
-        dwarf->callFrameForAddr[objaddr] = cie->execInsns(r, fde->iloc, objaddr);
-
-    const CallFrame &dcf = dwarf->callFrameForAddr[objaddr];
+    const UnwindRow *row = frameInfo->findRow(*fde, objaddr);
+    if (row == nullptr)
+        throw (Exception() << "no unwind rules for instruction address " << std::hex << ip << " in " << *elf->io);
 
     // Given the registers available, and the state of the call unwind data, calculate the CFA at this point.
-    cfa = getCFA(p, dcf);
+    cfa = getCFA(p, *row);
 
-    auto out = new StackFrame();
+    if (row->simple) {
+        // Registers are unchanged, other than those saved on the stack.
+        out.regs = regs;
+        out.validRegs = validRegs;
+    }
 #ifdef CFA_RESTORE_REGNO
     // "The CFA is defined to be the stack pointer in the calling frame."
-    out->setReg(CFA_RESTORE_REGNO, cfa);
+    out.setReg(CFA_RESTORE_REGNO, cfa);
 #endif
 
-    for (auto &entry : dcf.registers) {
-        const auto &unwind = entry.second;
-        const int regno = entry.first;
+    // The row's rules are ordered by register: take each from there, or
+    // failing that, the CIE's default frame.
+    auto rule = fde->rules.begin() + row->firstRule;
+    auto rulesEnd = fde->rules.begin() + row->lastRule;
+    for (int regno = 0; regno < MAXREG; ++regno) {
+        const auto &unwind = rule != rulesEnd && rule->regno == regno
+            ? (rule++)->unwind : cie->defaultFrame.registers[regno];
+        if (row->simple && unwind.type != OFFSET)
+            continue;
         switch (unwind.type) {
             case UNDEF:
             case SAME:
-                out->setReg(regno, getReg(regno));
+                if (hasReg(regno))
+                    out.setReg(regno, regs[regno]);
                 break;
             case OFFSET: {
                 Elf::Addr reg; // XXX: assume addrLen = sizeof Elf_Addr
-                p.io->readObj(cfa + unwind.u.offset, &reg);
-                out->setReg(regno, reg);
+                stackMem.readObj(cfa + unwind.u.offset, &reg);
+                out.setReg(regno, reg);
                 break;
             }
             case REG:
-                out->setReg(regno, getReg(unwind.u.reg));
+                out.setReg(regno, getReg(unwind.u.reg));
                 break;
 
             case VAL_EXPRESSION:
@@ -384,8 +427,8 @@ StackFrame::unwind(Process &p)
                 auto val = stack.eval(p, reader, this, elfReloc);
                 // EXPRESSIONs give an address, VAL_EXPRESSION gives a literal.
                 if (unwind.type == EXPRESSION)
-                    p.io->readObj(val, &val);
-                out->setReg(regno, val);
+                    stackMem.readObj(val, &val);
+                out.setReg(regno, val);
                 break;
             }
 
@@ -397,26 +440,124 @@ StackFrame::unwind(Process &p)
 
     // If the return address isn't defined, then we can't unwind.
     auto rar = cie->rar;
-    auto rarInfo = dcf.registers.find(rar);
-    if (rarInfo == dcf.registers.end() || rarInfo->second.type == UNDEF) {
-        delete out;
-        return nullptr;
+    if (rar < 0 || rar >= MAXREG || fde->rule(*cie, *row, rar).type == UNDEF)
+        return false;
+
+    out.ip = out.getReg(rar);
+    out.unwindMethod = UnwindMethod::DWARF;
+    return true;
+}
+
+#ifdef FPREG
+/*
+ * Does the function described by "fde" keep a frame pointer, so we can follow
+ * it out of the function's frames? Its CFI must save the frame pointer, and
+ * base the CFA on it, and it can't be a signal trampoline. This is worked out
+ * once per FDE, and remembered, so we don't search its rows for every frame.
+ */
+static bool
+keepsFramePointer(const CFI &cfi, const CIE &cie, const FDE &fde)
+{
+    auto verdict = fde.framePointer.load();
+    if (verdict == FDE::FP_UNKNOWN) {
+        verdict = FDE::FP_NOT_KEPT;
+        if (!cie.isSignalHandler && cfi.findRow(fde, fde.iloc) != nullptr) {
+            for (const auto &row : fde.rows) {
+                if (row.cfaReg == FPREG && row.cfaValue.type == OFFSET
+                      && fde.rule(cie, row, FPREG).type == OFFSET) {
+                    verdict = FDE::FP_KEPT;
+                    break;
+                }
+            }
+        }
+        fde.framePointer = verdict;
     }
+    return verdict == FDE::FP_KEPT;
+}
+#endif
 
-    out->ip = out->getReg(rar);
-    return out;
+/*
+ * Unwind by following the frame pointer, for code that maintains one: the
+ * caller's frame pointer and our return address are saved where it points.
+ * This can only recover the frame pointer, stack pointer and instruction
+ * pointer. If the frame doesn't look valid, or the function's CFI says it
+ * doesn't keep a frame pointer, return false, leaving "out" alone, so the
+ * caller can use the CFI instead.
+ */
+bool
+StackFrame::unwindFramePointer(Process &p, const Reader &stackMem, StackFrame &out)
+{
+#ifdef FPREG
+    if (!hasReg(FPREG) || !hasReg(SPREG))
+        return false;
+
+    // First, the cheap checks. The frame must be above the stack pointer, so
+    // the CFA increases, and aligned.
+    Elf::Addr fp = getReg(FPREG);
+    if (fp < getReg(SPREG) || fp % sizeof (Elf::Addr) != 0)
+        return false;
+
+    Elf::Addr saved[2]; // caller's frame pointer, and return address.
+    try {
+        if (stackMem.read(fp, sizeof saved, (char *)saved) != sizeof saved)
+            return false;
+    }
+    catch (const std::exception &) {
+        return false;
+    }
+
+    // The return address must be in the text of some loaded object.
+    Elf::Off reloc;
+    auto obj = p.findObject(saved[1], &reloc);
+    if (!obj)
+        return false;
+    auto segment = obj->getSegmentForAddress(saved[1] - reloc);
+    if (segment == nullptr || (segment->p_flags & PF_X) == 0)
+        return false;
+
+    // A function that doesn't keep a frame pointer leaves its caller's in
+    // place, so following it would skip the caller. Code with no CFI is
+    // assumed to keep one.
+    findCFI(p);
+    if (fde != nullptr && !keepsFramePointer(*frameInfo, *cie, *fde))
+        return false;
+
+    cfa = fp + sizeof saved;
+    out.setReg(FPREG, saved[0]);
+    out.setReg(SPREG, cfa);
+    out.setReg(IPREG, saved[1]);
+    out.ip = saved[1];
+    out.unwindMethod = UnwindMethod::FRAMEPOINTER;
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char *
+unwindMethodName(UnwindMethod method)
+{
+    switch (method) {
+        case UnwindMethod::REGISTERS: return "registers";
+        case UnwindMethod::DWARF: return "dwarf";
+        case UnwindMethod::FRAMEPOINTER: return "frame pointer";
+        case UnwindMethod::HEURISTIC: return "heuristic";
+    }
+    return "unknown";
 }
 
 void
 StackFrame::setReg(unsigned regno, cpureg_t regval)
 {
-    regs[regno] = regval;
+    if (regno < MAXREG) {
+        regs[regno] = regval;
+        validRegs.set(regno);
+    }
 }
 
 cpureg_t
 StackFrame::getReg(unsigned regno) const
 {
-    auto i = regs.find(regno);
-    return i != regs.end() ? i->second : 0;
+    return hasReg(regno) ? regs[regno] : 0;
 }
 }
@@ -81,9 +81,10 @@ Object::Object(ImageCache &cache, Reader::csptr io_)
     , notes(this)
     , elfHeader(io->readObj<Ehdr>(0))
     , imageCache(cache)
+    , debugLoaded(false)
+    , debugLoading(false)
     , lastSegmentForAddress(nullptr)
 {
-    debugLoaded = false;
     int i;
     size_t off;
 
@@ -142,10 +143,9 @@ Object::Object(ImageCache &cache, Reader::csptr io_)
 const Phdr *
 Object::getSegmentForAddress(Off a) const
 {
-    if (lastSegmentForAddress != nullptr &&
-          lastSegmentForAddress->p_vaddr <= a &&
-          lastSegmentForAddress->p_vaddr + lastSegmentForAddress->p_memsz > a)
-       return lastSegmentForAddress;
+    const Phdr *last = lastSegmentForAddress;
+    if (last != nullptr && last->p_vaddr <= a && last->p_vaddr + last->p_memsz > a)
+       return last;
     const auto &hdrs = getSegments(PT_LOAD);
 
     auto pos = std::lower_bound(hdrs.begin(), hdrs.end(), a,
@@ -289,11 +289,16 @@ Object::~Object() = default;
 Object *
 Object::getDebug() const
 {
-    if (!debugLoaded) {
-        debugLoaded = true;
+    if (debugLoaded)
+        return debugObject.get();
+    std::lock_guard<std::recursive_mutex> guard(imageCache.lock);
+    if (!debugLoaded && !debugLoading) {
+        debugLoading = true;
         auto &hdr = getSection(".gnu_debuglink", SHT_PROGBITS);
-        if (!hdr)
+        if (!hdr) {
+            debugLoaded = true;
             return 0;
+        }
         auto link = hdr.io->readString(0);
         auto dir = dirname(stringify(*io));
         debugObject = imageCache.getDebugImage(dir + "/" + link);
@@ -318,6 +323,7 @@ Object::getDebug() const
         }
         if (debugObject && verbose >= 2)
             *debug << "found debug object " << *debugObject->io << " for " << *io << "\n";
+        debugLoaded = true;
     }
     return debugObject.get();
 }
@@ -411,6 +417,7 @@ Section::Section(const Reader::csptr &image, off_t off)
 
 Object::sptr
 ImageCache::getImageForName(const string &name) {
+    std::lock_guard<std::recursive_mutex> guard(lock);
     bool found;
     auto res = getImageIfLoaded(name, found);
     if (found) {
@@ -420,17 +427,18 @@ ImageCache::getImageForName(const string &name) {
         throw (Exception() << "previously failed to load " << name);
     }
     auto &item = cache[name];
-    item = make_shared<Object>(*this, loadFile(name));
-    return item;
+    item.lastUsed = ++uses;
+    item.object = make_shared<Object>(*this, loadFile(name));
+    return item.object;
 }
 
-ImageCache::ImageCache() : elfHits(0), elfLookups(0) {}
+ImageCache::ImageCache() : elfHits(0), elfLookups(0), uses(0) {}
 ImageCache::~ImageCache() {
     if (verbose >= 2) {
         *debug << "ELF image cache: lookups: " << elfLookups << ", hits=" << elfHits << std::endl;
         for (auto &items : cache) {
-            if (items.second)
-                *debug << "\t" << *items.second->io << std::endl;
+            if (items.second.object)
+                *debug << "\t" << *items.second.object->io << std::endl;
             else
                 *debug << "\t" << "NEGATIVE: " << items.first << std::endl;
         }
@@ -440,19 +448,58 @@ ImageCache::~ImageCache() {
 Object::sptr
 ImageCache::getImageIfLoaded(const string &name, bool &found)
 {
+    std::lock_guard<std::recursive_mutex> guard(lock);
     elfLookups++;
     auto it = cache.find(name);
     if (it != cache.end()) {
         elfHits++;
         found = true;
-        return it->second;
+        it->second.lastUsed = ++uses;
+        return it->second.object;
     }
     found = false;
     return Object::sptr();
 }
 
+size_t
+ImageCache::memoryUsed(const Object::sptr &object)
+{
+    return object->io->size();
+}
+
+void
+ImageCache::trim(size_t limit)
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    size_t total = 0;
+    // Each entry, with the memory it uses.
+    std::vector<std::pair<std::map<std::string, Entry>::iterator, size_t>> byAge;
+    for (auto it = cache.begin(); it != cache.end(); ) {
+        if (it->second.object) {
+            auto used = memoryUsed(it->second.object);
+            total += used;
+            byAge.emplace_back(it++, used);
+        } else {
+            it = cache.erase(it); // let us try to load it again.
+        }
+    }
+    std::sort(byAge.begin(), byAge.end(),
+          [] (decltype(byAge[0]) l, decltype(byAge[0]) r) {
+             return l.first->second.lastUsed < r.first->second.lastUsed; });
+    for (auto &entry : byAge) {
+        if (total <= limit)
+            break;
+        total -= entry.second;
+        if (verbose >= 2)
+            *debug << "evicting " << *entry.first->second.object->io << " from image cache, freeing "
+                << std::dec << entry.second << " bytes\n";
+        cache.erase(entry.first);
+    }
+}
+
 Object::sptr
 ImageCache::getDebugImage(const string &name) {
+    std::lock_guard<std::recursive_mutex> guard(lock);
     // XXX: verify checksum.
     for (const auto &dir : globalDebugDirectories.dirs) {
         bool found;
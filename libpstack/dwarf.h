@@ -2,8 +2,11 @@
 #define DWARF_H
 
 #include <libpstack/elf.h>
+#include <atomic>
+#include <deque>
 #include <limits>
 #include <map>
+#include <mutex>
 #include <unordered_map>
 #include <list>
 #include <vector>
@@ -16,8 +19,41 @@ namespace Dwarf {
 
 enum HasChildren { DW_CHILDREN_yes = 1, DW_CHILDREN_no = 0 };
 
+enum UnitType {
+    DW_UT_compile = 0x1,
+    DW_UT_type = 0x2,
+    DW_UT_partial = 0x3,
+    DW_UT_skeleton = 0x4,
+    DW_UT_split_compile = 0x5,
+    DW_UT_split_type = 0x6
+};
+
+enum RangeListEntry {
+    DW_RLE_end_of_list = 0x0,
+    DW_RLE_base_addressx = 0x1,
+    DW_RLE_startx_endx = 0x2,
+    DW_RLE_startx_length = 0x3,
+    DW_RLE_offset_pair = 0x4,
+    DW_RLE_base_address = 0x5,
+    DW_RLE_start_end = 0x6,
+    DW_RLE_start_length = 0x7
+};
+
+enum LocationListEntry {
+    DW_LLE_end_of_list = 0x0,
+    DW_LLE_base_addressx = 0x1,
+    DW_LLE_startx_endx = 0x2,
+    DW_LLE_startx_length = 0x3,
+    DW_LLE_offset_pair = 0x4,
+    DW_LLE_default_location = 0x5,
+    DW_LLE_base_address = 0x6,
+    DW_LLE_start_end = 0x7,
+    DW_LLE_start_length = 0x8,
+    DW_LLE_GNU_view_pair = 0x9
+};
+
 class Attribute;
-class RawDIE;
+struct RawDIE;
 class ExpressionStack;
 class Info;
 class LineInfo;
@@ -27,9 +63,6 @@ struct CIE;
 struct CFI;
 class Unit;
 
-// The DWARF Unit's allEntries map contains the underlying data for the tree.
-typedef std::vector<size_t> Entries;
-
 #define DWARF_TAG(a,b) a = b,
 enum Tag {
 #include <libpstack/dwarf/tags.h>
@@ -80,14 +113,81 @@ enum LineEOpcode {
 };
 #undef DWARF_LINE_E
 
+/*
+ * The sizes of the forms whose encoding depends on the unit's header.
+ */
+struct UnitFormat {
+    uint8_t addrLen;   // DW_FORM_addr
+    uint8_t offsetLen; // DW_FORM_sec_offset, DW_FORM_ref_addr, ...
+    uint8_t strpLen;   // DW_FORM_strp (always 4 bytes in DWARF 2)
+    uint32_t key() const { return addrLen | offsetLen << 8 | strpLen << 16; }
+};
+
+/*
+ * A step in the decode plan for an abbreviation. Runs of adjacent fixed-size
+ * forms are collapsed into a single PLAN_FIXED step, as are runs of LEB128
+ * forms into a PLAN_LEB128 step. Anything else gets a step of its own.
+ */
+enum PlanStepType : uint8_t {
+    PLAN_FIXED,     // "size" bytes of fixed-size forms
+    PLAN_LEB128,    // "count" LEB128-encoded forms
+    PLAN_STRING,    // a single, NUL-terminated, DW_FORM_string
+    PLAN_BLOCK,     // a single block form, with its length prefix
+    PLAN_CONST,     // a single DW_FORM_implicit_const, stored in the abbreviation
+    PLAN_OTHER      // anything else, (decoded with Unit::readValue)
+};
+
+struct PlanStep {
+    PlanStepType type;
+    uint16_t first; // index of the first form covered by this step.
+    uint16_t count; // number of forms covered by this step.
+    uint32_t size;  // total size of the forms for PLAN_FIXED.
+};
+
 struct Abbreviation {
     Tag tag;
     bool hasChildren;
     std::vector<Form> forms;
-    using AttrNameMap = std::unordered_map<AttrName, size_t>;
-    AttrNameMap attrName2Idx;
-    Abbreviation(DWARFReader &);
-    Abbreviation() {}
+    std::vector<AttrName> names; // name of the attribute for each form.
+    std::vector<intmax_t> constants; // value of each DW_FORM_implicit_const.
+    std::vector<PlanStep> plan;
+    /*
+     * Offset of each attribute from the start of the DIE's attributes, or -1
+     * if it follows a variable-sized form. "fixedSize" is the size of all the
+     * attributes if they are all fixed-size, or -1.
+     */
+    std::vector<int32_t> offsets;
+    int32_t fixedSize;
+    /*
+     * Index in forms/names for each of the standard attribute names, or
+     * NOATTR if it's absent, so looking up an attribute by name is an array
+     * access. Vendor attributes fall back to searching "names".
+     */
+    static const size_t ATTRTABLESIZE = 0x90;
+    static const uint8_t NOATTR = 0xff;
+    uint8_t attrIdx[ATTRTABLESIZE];
+    int attrIndex(AttrName) const;
+    Abbreviation(DWARFReader &, const UnitFormat &);
+    Abbreviation() : tag(DW_TAG_none), hasChildren(false), fixedSize(0) {}
+private:
+    void makePlan(const UnitFormat &);
+};
+
+/*
+ * The abbreviations found at a particular offset in .debug_abbrev. This can
+ * be shared by many units, (particularly in LTO and dwz-processed binaries),
+ * so an Info parses each table only once for each UnitFormat.
+ */
+class AbbrevTable {
+    AbbrevTable(const AbbrevTable &) = delete;
+    // When the codes are compact, (the normal case), abbreviation with code N
+    // is at dense[N - 1], otherwise, we use the sparse map.
+    std::vector<Abbreviation> dense;
+    std::unordered_map<size_t, Abbreviation> sparse;
+public:
+    AbbrevTable(DWARFReader &, const UnitFormat &);
+    const Abbreviation *find(size_t code) const;
+    typedef std::shared_ptr<const AbbrevTable> csptr;
 };
 
 struct Pubname {
@@ -135,33 +235,39 @@ union Value {
 };
 
 
+/*
+ * Iterates over a set of sibling DIEs - moving to the next DIE skips the
+ * subtree of the current one.
+ */
 struct DIEIter {
     const Unit *u;
-    Entries::const_iterator rawIter;
+    size_t idx; // index of the DIE in the unit's entries.
     DIE operator *() const;
-    DIEIter &operator++() {
-        ++rawIter;
-        return *this;
-    }
-    DIEIter(const Unit *unit_, Entries::const_iterator rawIter_) :
-        u(unit_), rawIter(rawIter_) {}
+    DIEIter &operator++();
+    DIEIter(const Unit *unit_, size_t idx_) : u(unit_), idx(idx_) {}
     bool operator == (const DIEIter &rhs) const {
-        return rawIter == rhs.rawIter;
+        return idx == rhs.idx;
     }
     bool operator != (const DIEIter &rhs) const {
-        return rawIter != rhs.rawIter;
+        return idx != rhs.idx;
     }
 };
 
+/*
+ * A list of sibling DIEs: the children of some DIE, or the top-level DIEs of
+ * a unit. "first" is the index of the first sibling in the unit's entries,
+ * and "last" the index just past the subtree of the last one.
+ */
 struct DIEList {
     using const_iterator = DIEIter;
     using value_type = DIE;
     const Unit *unit;
-    const Entries &dies;
+    size_t first;
+    size_t last;
     DIEIter begin() const;
     DIEIter end() const;
-    DIEList(const Unit *unit_, const Entries &dies_)
-        : unit(unit_), dies(dies_) {}
+    DIEList(const Unit *unit_, size_t first_, size_t last_)
+        : unit(unit_), first(first_), last(last_) {}
 };
 
 class DIEAttributes {
@@ -172,19 +278,19 @@ public:
     using key_type = AttrName;
     struct const_iterator {
         const DIE &die;
-        Abbreviation::AttrNameMap::const_iterator rawIter;
+        size_t idx; // index of attribute in DIE's abbreviation.
         std::pair<AttrName, Attribute> operator *() const;
         const_iterator &operator++() {
-            ++rawIter;
+            ++idx;
             return *this;
         }
-        const_iterator(const DIE &die_, Abbreviation::AttrNameMap::const_iterator rawIter_) : 
-            die(die_), rawIter(rawIter_) {}
+        const_iterator(const DIE &die_, size_t idx_) :
+            die(die_), idx(idx_) {}
         bool operator == (const const_iterator &rhs) const {
-            return rawIter == rhs.rawIter;
+            return idx == rhs.idx;
         }
         bool operator != (const const_iterator &rhs) const {
-            return rawIter != rhs.rawIter;
+            return idx != rhs.idx;
         }
     };
     const_iterator begin() const;
@@ -249,7 +355,6 @@ enum FIType {
 };
 
 class FileEntry {
-    FileEntry() = delete;
     // copy-constructable.
 public:
     std::string name;
@@ -258,13 +363,18 @@ public:
     unsigned length;
     FileEntry(std::string name_, std::string dir_, unsigned lastMod_, unsigned length_);
     FileEntry(DWARFReader &r, LineInfo *info);
+    FileEntry() : lastMod(0), length(0) {}
 };
 
+/*
+ * The registers of the line number state machine, used while decoding a line
+ * program.
+ */
 class LineState {
     LineState() = delete;
 public:
     uintmax_t addr;
-    const FileEntry *file;
+    unsigned file;
     unsigned line;
     unsigned column;
     unsigned isa;
@@ -273,11 +383,44 @@ public:
     bool end_sequence:1;
     bool prologue_end:1;
     bool epilogue_begin:1;
-    LineState(LineInfo *);
+    LineState(bool default_is_stmt);
+};
+
+/*
+ * A row of the line number matrix. The address is an offset from the start of
+ * the row's sequence, and the file an index into LineInfo::files.
+ */
+struct LineRow {
+    uint32_t addr;
+    uint32_t line;
+    uint16_t file;
+};
+
+/*
+ * A sequence of rows with increasing addresses, covering [start, end). The
+ * file and line of the end_sequence row are kept so the original matrix can
+ * be reproduced.
+ */
+struct LineSequence {
+    Elf::Addr start;
+    Elf::Addr end;
+    uint32_t firstRow; // range of rows in LineInfo::rows
+    uint32_t lastRow;
+    uint32_t endLine;
+    uint16_t endFile;
+    bool endSequence; // false if the sequence was not terminated by DW_LNE_end_sequence
 };
 
 class LineInfo {
     LineInfo(const LineInfo &) = delete;
+    // Indexes of sequences sorted by start address, with the highest end
+    // address of the sequences up to each one, so overlapping sequences
+    // can be found.
+    std::vector<uint32_t> byAddr;
+    std::vector<Elf::Addr> maxEnd;
+    bool inSequence;
+    void addRow(const LineState &);
+    void endSequence(Elf::Addr end, const LineState *);
 public:
     LineInfo() {}
     bool default_is_stmt;
@@ -285,49 +428,122 @@ public:
     std::vector<int> opcode_lengths;
     std::vector<std::string> directories;
     std::vector<FileEntry> files;
-    std::vector<LineState> matrix;
+    std::vector<LineSequence> sequences; // in the order they appear in the program.
+    std::vector<LineRow> rows;
     void build(DWARFReader &, const Unit *);
+    // Find the rows covering an address.
+    void find(Elf::Addr, std::vector<const LineRow *> &) const;
+    size_t memoryUsed() const; // approximately, in bytes.
 };
 }
 
 namespace Dwarf {
+/*
+ * The DIEs of a unit are stored in a flat array, in the order they appear in
+ * .debug_info, so a DIE's descendents immediately follow it, and "sibling" is
+ * the index of the first entry past its subtree. The attribute values for the
+ * DIE are stored contiguously in the unit's value array, from "firstValue"
+ */
+struct RawDIE {
+    const Abbreviation *type;
+    uint32_t firstValue;
+    uint32_t sibling;
+};
+
+/*
+ * A list of [start, end) address ranges, as described by a DW_AT_low_pc and
+ * DW_AT_high_pc pair, or a DW_AT_ranges attribute.
+ */
+typedef std::vector<std::pair<Elf::Addr, Elf::Addr>> RangeList;
+
 class Unit {
     Unit() = delete;
     Unit(const Unit &) = delete;
     std::unique_ptr<LineInfo> lines;
-    std::unordered_map<size_t, Abbreviation> abbreviations;
-    Entries entries;
-    std::map<off_t, RawDIE> allEntries;
+    AbbrevTable::csptr abbreviations;
+    /*
+     * The DIEs are only decoded into the unit's storage when first needed, so
+     * callers interested only in the root DIE's attributes, or that are
+     * scanning for a handful of entries, don't pay for the whole unit.
+     */
+    Elf::Off entriesOffset; // offset in io of the first DIE.
+    Elf::Off end; // offset in io just past the unit.
+    mutable bool decoded;
+    mutable std::vector<RawDIE> entries;
+    mutable std::vector<uint32_t> entryOffsets; // unit-relative offset of each DIE in entries.
+    mutable std::vector<Value> values;
+    mutable std::deque<Block> blocks; // Values for block forms point in here.
+    /*
+     * Values from the root DIE needed to interpret the forms of other DIEs:
+     * the base address for range lists, and the DWARF 5 offsets of the unit's
+     * contributions to .debug_str_offsets, .debug_addr, .debug_rnglists and
+     * .debug_loclists.
+     */
+    mutable bool rootRead;
+    mutable Elf::Addr baseAddr;
+    mutable Elf::Off strOffsetsBase;
+    mutable Elf::Off addrBase;
+    mutable Elf::Off rnglistsBase;
+    mutable Elf::Off loclistsBase;
+    void readRoot() const;
+    void decode() const;
+    void decodeEntries(DWARFReader &r) const;
+    void readValue(DWARFReader &, Form form, Value &value) const;
+    void skipStep(DWARFReader &, const Abbreviation &, const PlanStep &) const;
+    DIE entryAt(size_t idx) const;
+    friend class Attribute;
+    friend class DIE;
+    friend struct DIEIter;
 public:
     const Abbreviation *findAbbreviation(size_t) const;
-    DIEList topLevelDIEs() const { return DIEList(this, entries); }
+    DIEList topLevelDIEs() const { decode(); return DIEList(this, 0, entries.size()); }
     DIE offsetToDIE(size_t offset) const;
+
+    /*
+     * Access to the encoded DIEs without decoding them into the unit.
+     * rootEntry positions the reader at the root DIE's attributes, and returns
+     * its abbreviation. With the reader positioned at the attributes of a DIE,
+     * readAttribute will find a single attribute value, skipAttributes will
+     * move past its attributes, and skipEntry past its entire subtree.
+     */
+    const Abbreviation *rootEntry(DWARFReader &) const;
+    bool readAttribute(DWARFReader &, const Abbreviation &, AttrName, Form &, Value &) const;
+    void skipAttributes(DWARFReader &, const Abbreviation &) const;
+    void skipEntry(DWARFReader &, const Abbreviation &) const;
+
+    /*
+     * Find the address ranges of a DIE from its DW_AT_low_pc/DW_AT_high_pc or
+     * DW_AT_ranges attributes, given a reader positioned at its attributes.
+     * (The reader is not advanced.) Returns false if it has neither.
+     */
+    bool entryRanges(const DWARFReader &, const Abbreviation &, RangeList &) const;
+    // Decode the range list referenced by a DW_AT_ranges attribute.
+    void rangeList(Form, const Value &, RangeList &) const;
+    // Find the location description in the DWARF 5 location list referenced
+    // by a DW_AT_location attribute that covers "addr", (an address in the
+    // object,) as a block of .debug_loclists. Returns false if none does.
+    bool locationList(Form, const Value &, Elf::Addr addr, Block &) const;
+    Elf::Addr addrx(uintmax_t idx) const; // Address from .debug_addr
+    std::string strx(uintmax_t idx) const; // String from .debug_str_offsets
+
     const Info *dwarf;
     Reader::csptr io;
     off_t offset;
     size_t dwarfLen;
-    void decodeEntries(DWARFReader &r, Entries &entries);
     uint32_t length;
     uint16_t version;
     uint8_t addrlen;
+    uint8_t unitType;
+    UnitFormat format;
     Unit(const Info *, DWARFReader &);
     std::string name() const;
     const LineInfo *getLines();
+    size_t memoryUsed() const; // by the decoded DIEs and lines, approximately.
     ~Unit();
     typedef std::shared_ptr<Unit> sptr;
     typedef std::shared_ptr<const Unit> csptr;
 };
 
-struct FDE {
-    uintmax_t iloc;
-    uintmax_t irange;
-    Elf::Off instructions;
-    Elf::Off end;
-    Elf::Off cieOff;
-    std::vector<unsigned char> augmentation;
-    FDE(CFI *, DWARFReader &, Elf::Off cieOff_, Elf::Off endOff_);
-};
-
 enum RegisterType {
     UNDEF,
     SAME,
@@ -350,14 +566,68 @@ struct RegisterUnwind {
     } u;
 };
 
+/*
+ * One more than the highest DWARF register number in archreg.h - the size of
+ * the register rule arrays.
+ */
+constexpr int
+registerCount()
+{
+    int count = 0;
+#define REGMAP(number, field) if (number >= count) count = number + 1;
+#include "libpstack/dwarf/archreg.h"
+#undef REGMAP
+    return count;
+}
+constexpr int MAXREG = registerCount();
+
 struct CallFrame {
-    std::map<int, RegisterUnwind> registers;
+    RegisterUnwind registers[MAXREG];
     int cfaReg;
     RegisterUnwind cfaValue;
     CallFrame();
     // default copy constructor is valid.
 };
 
+/*
+ * A row of an FDE's unwind table: the rules from "start" up to the start of
+ * the next row. Only the rules for registers that differ from the CIE's
+ * default frame are kept, in the FDE's "rules", ordered by register number.
+ */
+struct UnwindRow {
+    Elf::Addr start;
+    int cfaReg;
+    RegisterUnwind cfaValue;
+    uint32_t firstRule;
+    uint32_t lastRule;
+    // The CFA is a register plus offset, and registers are either unchanged
+    // or saved at an offset from the CFA.
+    bool simple;
+};
+
+struct RegisterRule {
+    int regno;
+    RegisterUnwind unwind;
+};
+
+struct FDE {
+    uintmax_t iloc;
+    uintmax_t irange;
+    Elf::Off instructions;
+    Elf::Off end;
+    Elf::Off cieOff;
+    std::vector<unsigned char> augmentation;
+    mutable std::vector<UnwindRow> rows; // built on first use by CFI::findRow
+    mutable std::vector<RegisterRule> rules; // for the rows.
+    // Whether the function keeps a frame pointer, for unwinding with -F:
+    // worked out from the rows on first use.
+    enum FramePointer : char { FP_UNKNOWN, FP_KEPT, FP_NOT_KEPT };
+    mutable std::atomic<FramePointer> framePointer;
+    FDE(const CFI *, DWARFReader &, Elf::Off cieOff_, Elf::Off endOff_);
+    // The rule for a register in one of our rows.
+    const RegisterUnwind &rule(const CIE &, const UnwindRow &, int regno) const;
+};
+
 struct CIE {
     const CFI *frameInfo;
     uint8_t version;
@@ -371,28 +641,169 @@ struct CIE {
     Elf::Off end;
     uintmax_t personality;
     std::string augmentation;
+    CallFrame defaultFrame; // state after the initial instructions.
     CIE(const CFI *, DWARFReader &, Elf::Off);
     CIE() {}
-    CallFrame execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const;
+    CallFrame execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr,
+          const FDE *rowsFor = nullptr) const;
+private:
+    void addRow(const FDE &, Elf::Addr, const CallFrame &) const;
 };
 
 /*
  * CFI represents call frame information (generally contents of .debug_frame or .eh_frame)
+ * CIEs and FDEs are decoded on demand, and cached by their offset in the
+ * section. FDEs are found by address using the binary search table in
+ * .eh_frame_hdr, if we have one, or a sorted index built on first use.
  */
 struct CFI {
     const Info *dwarf;
-    Elf::Word sectionAddr; // virtual address of this section  (may need to be offset by load address)
+    Elf::Addr sectionAddr; // virtual address of this section  (may need to be offset by load address)
     Reader::csptr io;
     FIType type;
-    std::map<Elf::Addr, CIE> cies;
-    std::list<FDE> fdeList;
-    CFI(Info *, const Elf::Section &, FIType);
+    CFI(const Info *, const Elf::Section &, FIType, const Elf::Section &hdr = Elf::Section());
     CFI() = delete;
     CFI(const CFI &) = delete;
-    Elf::Addr decodeCIEFDEHdr(DWARFReader &, FIType, Elf::Off *cieOff); // cieOFF set to -1 if this is CIE, set to offset of associated CIE for an FDE
+    Elf::Addr decodeCIEFDEHdr(DWARFReader &, FIType, Elf::Off *cieOff) const; // cieOFF set to -1 if this is CIE, set to offset of associated CIE for an FDE
     const FDE *findFDE(Elf::Addr) const;
-    bool isCIE(Elf::Addr);
+    const UnwindRow *findRow(const FDE &, Elf::Addr) const;
+    const CIE &getCIE(Elf::Off) const;
+    const FDE &getFDE(Elf::Off) const;
+    void decodeAll() const; // decode every CIE and FDE in the section.
+    const std::map<Elf::Off, CIE> &getCIEs() const { return cies; }
+    const std::map<Elf::Off, FDE> &getFDEs() const { return fdes; }
+    bool isCIE(Elf::Addr) const;
     intmax_t decodeAddress(DWARFReader &, int encoding) const;
+    size_t memoryUsed() const; // by the decoded CIEs and FDEs, approximately.
+private:
+    // Protects the caches below, which threads unwinding in parallel share.
+    // Recursive, as decoding an FDE decodes its CIE.
+    mutable std::recursive_mutex lock;
+    mutable std::map<Elf::Off, CIE> cies;
+    mutable std::map<Elf::Off, FDE> fdes;
+
+    // The search table from .eh_frame_hdr: "hdrCount" pairs of 4-byte
+    // initial location and FDE address, relative to "hdrAddr"
+    Reader::csptr hdr;
+    Elf::Addr hdrAddr;
+    Elf::Off hdrTable;
+    size_t hdrCount;
+    bool readHeader(const Elf::Section &);
+
+    // Without the table, (initial location, offset) for each FDE, by location.
+    mutable std::vector<std::pair<Elf::Addr, Elf::Off>> fdeIndex;
+    mutable std::atomic<bool> fdesIndexed;
+    void indexFDEs() const;
+    size_t indexSize() const;
+    std::pair<Elf::Addr, Elf::Off> indexEntry(size_t) const;
+};
+
+/*
+ * The range of addresses [start, end) covered by a subprogram, and the
+ * offsets of its unit and DIE in .debug_info
+ */
+struct FunctionRange {
+    Elf::Addr start;
+    Elf::Addr end;
+    Elf::Off unit;
+    Elf::Off die;
+};
+
+/*
+ * The range of addresses [start, end) covered by a unit, and the unit's offset
+ * in .debug_info
+ */
+struct UnitRange {
+    Elf::Addr start;
+    Elf::Addr end;
+    Elf::Off unit;
+};
+
+/*
+ * What we know about an address in an image, for describing a stack frame.
+ */
+struct Symbolization {
+    DIE function; // the DWARF subprogram containing the address, if any.
+    bool haveOffset; // does "function" have a low pc for us to be offset from?
+    Elf::Addr offset;
+    bool haveSymbol; // the ELF symbol containing the address, if any.
+    std::string symbol;
+    std::string demangled; // "symbol" demangled, if it's a mangled C++ name.
+    Elf::Addr symbolOffset;
+    bool haveSource; // "source" is filled in only when asked for.
+    std::vector<std::pair<std::string, int>> source; // of the call, for a return address.
+    Symbolization() : haveOffset(false), offset(0), haveSymbol(false), symbolOffset(0), haveSource(false) {}
+};
+
+/*
+ * An entry for a name in an accelerator table. "die" is the offset of the
+ * DIE in .debug_info, or zero if the table only identifies the unit.
+ */
+struct NameEntry {
+    Elf::Off unit;
+    Elf::Off die;
+};
+
+/*
+ * An accelerator table, mapping names of functions, types and variables to
+ * the units, (and possibly the DIEs) that describe them, and perhaps also
+ * addresses to units.
+ */
+class NameIndex {
+public:
+    virtual void findName(const std::string &, std::vector<NameEntry> &) const = 0;
+    // Add address ranges for units, returning false if there are none.
+    virtual bool unitRanges(std::vector<UnitRange> &) const = 0;
+    virtual ~NameIndex() {}
+    typedef std::unique_ptr<const NameIndex> cuptr;
+};
+
+/*
+ * The DWARF 5 .debug_names section. This may contain several name indexes,
+ * (e.g., one per unit if the linker didn't merge them.)
+ */
+class DebugNames : public NameIndex {
+    struct Index {
+        Elf::Off offset; // start of the index in the section.
+        size_t dwarfLen;
+        uint32_t bucketCount;
+        uint32_t nameCount;
+        std::vector<Elf::Off> units; // offsets of CUs in .debug_info
+        Elf::Off buckets;
+        Elf::Off hashes;
+        Elf::Off stringOffsets;
+        Elf::Off entryOffsets;
+        Elf::Off entryPool;
+        // abbreviation code -> (DW_IDX_*, form) pairs for its attributes.
+        std::unordered_map<uintmax_t, std::vector<std::pair<uintmax_t, Form>>> abbrevs;
+    };
+    Reader::csptr io;
+    Reader::csptr strings;
+    std::vector<Index> indexes;
+    void readEntries(const Index &, Elf::Off, std::vector<NameEntry> &) const;
+public:
+    DebugNames(Reader::csptr io, Reader::csptr strings);
+    void findName(const std::string &, std::vector<NameEntry> &) const override;
+    bool unitRanges(std::vector<UnitRange> &) const override { return false; }
+};
+
+/*
+ * GDB's .gdb_index section, (versions 7 and 8.) This only identifies the unit
+ * for each name, but does have an address table.
+ */
+class GdbIndex : public NameIndex {
+    Reader::csptr io;
+    uint32_t version;
+    std::vector<Elf::Off> units;
+    Elf::Off addressArea;
+    Elf::Off addressEnd;
+    Elf::Off symbolTable;
+    uint32_t symbolSlots;
+    Elf::Off constantPool;
+public:
+    GdbIndex(Reader::csptr io);
+    void findName(const std::string &, std::vector<NameEntry> &) const override;
+    bool unitRanges(std::vector<UnitRange> &) const override;
 };
 
 class ImageCache;
@@ -406,28 +817,79 @@ public:
     typedef std::shared_ptr<Info> sptr;
     typedef std::shared_ptr<const Info> csptr;
     Reader::csptr io; // XXX: io is public because "block" Attributes need to read from it.
-    std::map<Elf::Addr, CallFrame> callFrameForAddr;
     Elf::Object::sptr elf;
-    std::unique_ptr<CFI> debugFrame;
-    std::unique_ptr<CFI> ehFrame;
     Reader::csptr debugStrings;
     Reader::csptr abbrev;
     Reader::csptr lineshdr;
+    Reader::csptr lineStrings; // .debug_line_str
+    Reader::csptr strOffsets; // .debug_str_offsets
+    Reader::csptr addrTable; // .debug_addr
+    Reader::csptr rangesh; // .debug_ranges
+    Reader::csptr rnglistsh; // .debug_rnglists
+    Reader::csptr loclistsh; // .debug_loclists
     Info::sptr getAltDwarf() const;
     std::list<ARangeSet> &ranges() const;
     const std::list<PubnameUnit> &pubnames() const;
-    Unit::sptr getUnit(off_t offset);
+    Unit::sptr getUnit(off_t offset) const;
     std::list<Unit::sptr> getUnits() const;
+    AbbrevTable::csptr getAbbrevTable(Elf::Off offset, const UnitFormat &) const;
     std::vector<std::pair<std::string, int>> sourceFromAddr(uintmax_t addr);
+    DIE findFunction(Elf::Addr) const;
+    // Describe an address, for a stack frame. The result is cached: many
+    // frames, from many threads and samples, share the same addresses.
+    const Symbolization &symbolize(Elf::Addr, bool withSource);
+    // The .debug_names or .gdb_index accelerator table, if there is one.
+    const NameIndex *nameIndex() const;
+    // Find DIEs for a name, using the accelerator table.
+    std::vector<DIE> findNames(const std::string &) const;
+    std::vector<Unit::sptr> unitsForAddr(Elf::Addr) const;
     bool hasRanges() { ranges(); return aranges.size() != 0; }
+    // Call frame information, decoded when first asked for.
+    const CFI *getEhFrame() const;
+    const CFI *getDebugFrame() const;
+    // Find the FDE for an address in .eh_frame, or failing that, .debug_frame
+    const FDE *findFDE(Elf::Addr, const CFI **) const;
+    // Roughly how much memory the decoded data uses, so the image cache can
+    // count it against its limit. DIEs must not be being decoded meanwhile.
+    size_t memoryUsed();
 
 private:
+    std::mutex symbolsLock; // protects symbolizations
+    std::unordered_map<Elf::Addr, Symbolization> symbolizations;
+    mutable std::mutex cfiLock; // protects ehFrame and debugFrame
+    mutable std::unique_ptr<CFI> ehFrame;
+    mutable std::unique_ptr<CFI> debugFrame;
+    mutable bool ehFrameLoaded;
+    mutable bool debugFrameLoaded;
+    std::unique_ptr<CFI> loadCFI(const char *, FIType, const Elf::Section &hdr) const;
+    /*
+     * Address ranges of the subprograms in the image, sorted by address, and
+     * built on the first call to findFunction. Nested functions are split out
+     * of their parents, so the ranges don't overlap, and the innermost
+     * function covering an address is the one found.
+     */
+    mutable std::vector<FunctionRange> functions;
+    mutable bool functionsIndexed;
+    void indexFunctions() const;
+    /*
+     * Non-overlapping address ranges of the units, sorted by address, built on
+     * the first call to unitsForAddr. These come from .debug_aranges, and
+     * from the root DIEs of any units it doesn't describe. Units with no
+     * address information at all are listed separately in unrangedUnits.
+     */
+    mutable std::vector<UnitRange> unitRanges;
+    mutable std::vector<Elf::Off> unrangedUnits;
+    mutable bool unitsIndexed;
+    void indexUnits() const;
+    mutable NameIndex::cuptr names;
+    mutable bool namesLoaded;
     std::string getAltImageName() const;
     mutable std::list<PubnameUnit> pubnameUnits;
     mutable std::list<ARangeSet> aranges;
     // These are mutable so we can lazy-eval them when getters are called, and
     // maintain logical constness.
     mutable std::map<Elf::Off, Unit::sptr> unitsm;
+    mutable std::map<std::pair<Elf::Off, uint32_t>, AbbrevTable::csptr> abbrevTables;
     mutable Info::sptr altDwarf;
     mutable bool altImageLoaded;
     ImageCache &imageCache;
@@ -443,7 +905,10 @@ class ImageCache : public Elf::ImageCache {
     int dwarfHits;
     int dwarfLookups;
     std::map<Elf::Object::sptr, Info::sptr> dwarfCache;
+protected:
+    size_t memoryUsed(const Elf::Object::sptr &) override;
 public:
+    void trim(size_t limit) override;
     Info::sptr getDwarf(const std::string &);
     Info::sptr getDwarf(Elf::Object::sptr);
     ImageCache();
@@ -558,9 +1023,12 @@ public:
     }
     Elf::Off getlength(size_t *);
     void skip(Elf::Off amount) { off += amount; }
+    void skipleb128(size_t count);
 };
 
 std::string typeName(const DIE &);
+// The subprogram in "entry", or below it, covering "address". Prefer
+// Info::findFunction, which searches the whole image.
 DIE findEntryForFunc(Elf::Addr address, const DIE &entry);
 
 
@@ -585,6 +1053,7 @@ enum ExpressionOp {
 #define DW_EH_PE_datarel        0x30
 #define DW_EH_PE_funcrel        0x40
 #define DW_EH_PE_aligned        0x50
+#define DW_EH_PE_omit   0xff
 }
 std::ostream &operator << (std::ostream &os, const JSON<Dwarf::Info> &);
 
@@ -2,6 +2,7 @@
 #ifdef __i386__
 #define IPREG 8
 #define SPREG 4
+#define FPREG 5
 #define CFA_RESTORE_REGNO 4
 REGMAP(1, eax)
 REGMAP(2, ecx)
@@ -23,6 +24,9 @@ REGMAP(14, xfs)
 #define CFA_RESTORE_REGNO 7
 #define IPREG 16
 #define SPREG 7
+#define FPREG 6
+#define SSEREG 17 // %xmm0: the rest of the SSEREGS follow it.
+#define SSEREGS 16
 REGMAP(0, rax)
 REGMAP(1, rdx)
 REGMAP(2, rcx)
@@ -87,6 +91,7 @@ REGMAP(59, gs_base)
 
 #ifdef __ARM_ARCH
 #define IPREG 15
+#define SPREG 13
 #define CFA_RESTORE_REGNO 13
 REGMAP(0, regs[0])
 REGMAP(1, regs[1])
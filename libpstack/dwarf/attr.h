@@ -69,6 +69,10 @@ DWARF_ATTR(DW_AT_trampoline, 0x56)
 DWARF_ATTR(DW_AT_call_column, 0x57)
 DWARF_ATTR(DW_AT_call_file, 0x58)
 DWARF_ATTR(DW_AT_linkage_name, 0x6E)
+DWARF_ATTR(DW_AT_str_offsets_base, 0x72)
+DWARF_ATTR(DW_AT_addr_base, 0x73)
+DWARF_ATTR(DW_AT_rnglists_base, 0x74)
+DWARF_ATTR(DW_AT_loclists_base, 0x8c)
 
 DWARF_ATTR(DW_AT_lo_user, 0x2000)
 DWARF_ATTR(DW_AT_hi_user, 0x3fff)
@@ -22,8 +22,25 @@ DWARF_FORM(DW_FORM_indirect, 0x16)
 DWARF_FORM(DW_FORM_sec_offset, 0x17)
 DWARF_FORM(DW_FORM_exprloc, 0x18)
 DWARF_FORM(DW_FORM_flag_present, 0x19)
-// XXX: 1a->1f
+DWARF_FORM(DW_FORM_strx, 0x1a)
+DWARF_FORM(DW_FORM_addrx, 0x1b)
+DWARF_FORM(DW_FORM_ref_sup4, 0x1c)
+DWARF_FORM(DW_FORM_strp_sup, 0x1d)
+DWARF_FORM(DW_FORM_data16, 0x1e)
+DWARF_FORM(DW_FORM_line_strp, 0x1f)
 DWARF_FORM(DW_FORM_ref_sig8, 0x20)
+DWARF_FORM(DW_FORM_implicit_const, 0x21)
+DWARF_FORM(DW_FORM_loclistx, 0x22)
+DWARF_FORM(DW_FORM_rnglistx, 0x23)
+DWARF_FORM(DW_FORM_ref_sup8, 0x24)
+DWARF_FORM(DW_FORM_strx1, 0x25)
+DWARF_FORM(DW_FORM_strx2, 0x26)
+DWARF_FORM(DW_FORM_strx3, 0x27)
+DWARF_FORM(DW_FORM_strx4, 0x28)
+DWARF_FORM(DW_FORM_addrx1, 0x29)
+DWARF_FORM(DW_FORM_addrx2, 0x2a)
+DWARF_FORM(DW_FORM_addrx3, 0x2b)
+DWARF_FORM(DW_FORM_addrx4, 0x2c)
 //XXX: GNU extensions. Please someone show me a proper references for these.
 DWARF_FORM(DW_FORM_GNU_strp_alt, 0x1f21)
 DWARF_FORM(DW_FORM_GNU_ref_alt, 0x1f20)
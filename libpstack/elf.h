@@ -42,8 +42,10 @@ extern bool noDebugLibs;
 #include <string>
 #include <list>
 #include <vector>
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <limits>
 
 #include "libpstack/util.h"
@@ -206,7 +208,8 @@ private:
     std::map<std::string, Section *> namedSection;
     std::map<Word, ProgramHeaders> programHeaders;
 
-    mutable bool debugLoaded; // We've at least attempted to load debugObject: don't try again
+    mutable std::atomic<bool> debugLoaded; // We've at least attempted to load debugObject: don't try again
+    mutable bool debugLoading; // guards against recursion while loading debugObject
     mutable Object::sptr debugData; // symbol table data as extracted from .gnu.debugdata
     mutable Object::sptr debugObject; // debug object as per .gnu_debuglink/other.
 
@@ -219,7 +222,7 @@ private:
         CachedSymbol() : disposition { SYM_NEW } {}
     };
     std::map<std::string, CachedSymbol> cachedSymbols;
-    mutable const Phdr *lastSegmentForAddress; // cache of last segment returned for a specific address.
+    mutable std::atomic<const Phdr *> lastSegmentForAddress; // cache of last segment returned for a specific address.
 };
 
 /*
@@ -260,6 +263,8 @@ typedef struct pt_regs CoreRegisters;
 #else
 typedef struct user_regs_struct CoreRegisters;
 #endif
+// ... and the NT_FPREGSET floating point/vector registers.
+typedef elf_fpregset_t CoreFPRegisters;
 
 class NoteDesc {
    Note note;
@@ -368,15 +373,31 @@ extern GlobalDebugDirectories globalDebugDirectories;
  * & st_ino + st_dev)
  */
 class ImageCache {
-    std::map<std::string, Object::sptr> cache;
+    struct Entry {
+        Object::sptr object; // null if we failed to load it.
+        unsigned long lastUsed;
+    };
+    std::map<std::string, Entry> cache;
     int elfHits;
     int elfLookups;
+    unsigned long uses; // ticks on each lookup, to find the least recently used.
+    friend class Object;
+protected:
+    // Held while loading images, so threads can share the cache. Recursive,
+    // as loading an image can load its debug image.
+    std::recursive_mutex lock;
+    // The memory we'd free by dropping an image: by default, its size.
+    virtual size_t memoryUsed(const Object::sptr &);
 public:
     ImageCache();
     virtual ~ImageCache();
     Object::sptr getImageForName(const std::string &name);
     Object::sptr getImageIfLoaded(const std::string &name, bool &found);
     Object::sptr getDebugImage(const std::string &name);
+    // Drop the least recently used images until those left use no more than
+    // "limit" bytes, and forget any we failed to load. Images still in use
+    // stay alive until released.
+    virtual void trim(size_t limit);
 };
 
 } // Elf namespace
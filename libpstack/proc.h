@@ -3,11 +3,15 @@ extern "C" {
 #include <thread_db.h>
 }
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <map>
 #include <set>
 #include <sstream>
 #include <functional>
 #include <bitset>
+#include <vector>
 
 #include "libpstack/ps_callback.h"
 #include "libpstack/dwarf.h"
@@ -32,58 +36,132 @@ public:
 // this works for i386 and x86_64 - might need to change for other archs.
 typedef unsigned long cpureg_t;
 
+// How we found the registers for a frame.
+enum class UnwindMethod {
+    REGISTERS, // from the thread's registers: the innermost frame.
+    DWARF, // by executing the CFI for the called function.
+    FRAMEPOINTER, // by following the frame pointer chain.
+    HEURISTIC // by guessing, after the CFI failed.
+};
+const char *unwindMethodName(UnwindMethod);
+
 struct StackFrame {
     Elf::Addr ip;
     Elf::Addr cfa;
-    std::map<unsigned, cpureg_t> regs;
+    // Register values, indexed by DWARF register number, and which are set.
+    std::array<cpureg_t, MAXREG> regs;
+    std::bitset<MAXREG> validRegs;
     Elf::Object::sptr elf;
     Elf::Addr elfReloc;
     Info::sptr dwarf;
     Dwarf::DIE function;
-    CFI *frameInfo;
+    const CFI *frameInfo;
     const FDE *fde;
     const CIE *cie;
+    UnwindMethod unwindMethod;
     StackFrame()
         : ip(-1)
         , cfa(0)
+        , elfReloc(0)
         , dwarf(0)
         , function()
         , frameInfo(0)
         , fde(0)
         , cie(0)
+        , unwindMethod(UnwindMethod::REGISTERS)
     {}
     void setReg(unsigned, cpureg_t);
     cpureg_t getReg(unsigned regno) const;
-    Elf::Addr getCFA(const Process &, const CallFrame &) const;
-    StackFrame *unwind(Process &p);
+    bool hasReg(unsigned regno) const { return regno < MAXREG && validRegs[regno]; }
+    Elf::Addr getCFA(const Process &, const UnwindRow &) const;
+    void findCFI(Process &p);
+    // "stackMem" reads the thread's stack: see StackWindow.
+    bool unwind(Process &p, const Reader &stackMem, StackFrame &out);
+    bool unwindFramePointer(Process &p, const Reader &stackMem, StackFrame &out);
     void setCoreRegs(const Elf::CoreRegisters &);
+    void setCoreFPRegs(const Elf::CoreFPRegisters &);
     void getCoreRegs(Elf::CoreRegisters &) const;
     void getFrameBase(const Process &, intmax_t, ExpressionStack *) const;
 };
 }
 
-struct ThreadStack {
-    td_thrinfo_t info;
-    std::vector<Dwarf::StackFrame *> stack;
-    ThreadStack() {
-        memset(&info, 0, sizeof info);
-    }
-    ~ThreadStack() {
-        for (auto i = stack.begin(); i != stack.end(); ++i)
-            delete *i;
-    }
-    void unwind(Process &, Elf::CoreRegisters &regs);
+/*
+ * Storage for the stack frames of one capture. Frames are allocated by value
+ * in blocks, so their addresses don't change, and are all released together
+ * when the arena is destroyed.
+ */
+class FrameArena {
+    static const size_t blockSize = 256;
+    std::vector<std::unique_ptr<Dwarf::StackFrame[]>> blocks;
+    size_t used;
+public:
+    FrameArena() : used(0) {}
+    FrameArena(const FrameArena &) = delete;
+    Dwarf::StackFrame *alloc();
+    void release(Dwarf::StackFrame *); // return the most recent allocation.
+};
+
+/*
+ * A thread's stack, from its stack pointer to the end of the stack's mapping,
+ * read from the process in one go, so unwinding needn't read each saved
+ * register separately. Reads outside the window go to the process.
+ */
+class StackWindow : public Reader {
+    Reader::csptr upstream;
+    Elf::Addr start;
+    std::vector<char> data;
+public:
+    static const size_t maxSize = 1024 * 1024; // the most we read up front.
+    static const size_t defaultSize = 64 * 1024; // if we don't know the mapping.
+    StackWindow(Reader::csptr upstream_, Elf::Addr sp, Elf::Addr mappingEnd);
+    size_t read(off_t off, size_t count, char *ptr) const override;
+    void describe(std::ostream &os) const override { os << *upstream; }
+    off_t size() const override { return upstream->size(); }
+    std::string filename() const override { return upstream->filename(); }
 };
 
 enum PstackOption {
     nosrc,
     doargs,
     nothreaddb,
+    framepointer,
     maxopt // leave this last
 };
 
 using PstackOptions = std::bitset<PstackOption::maxopt>;
 
+struct ThreadStack {
+    td_thrinfo_t info;
+    std::vector<Dwarf::StackFrame *> stack; // frames are owned by a FrameArena
+    std::string error; // why we have no stack for the thread.
+    ThreadStack() {
+        memset(&info, 0, sizeof info);
+    }
+    void unwind(Process &, FrameArena &, Elf::CoreRegisters &regs,
+          const Elf::CoreFPRegisters *fpregs, const PstackOptions &);
+};
+
+/*
+ * A copy of regions of a process's memory, taken while it is stopped, so we
+ * can unwind from it after the process resumes. Reads outside the copied
+ * regions go to the live process.
+ */
+class SnapshotReader : public Reader {
+    Reader::csptr upstream;
+    std::map<Elf::Addr, std::vector<char>> regions; // keyed by start address.
+    size_t copied;
+    mutable std::atomic<size_t> misses;
+public:
+    SnapshotReader(Reader::csptr upstream_);
+    ~SnapshotReader();
+    void capture(Elf::Addr start, size_t size);
+    void captureStack(const Elf::CoreRegisters &, size_t size);
+    size_t read(off_t off, size_t count, char *ptr) const override;
+    void describe(std::ostream &os) const override { os << *upstream; }
+    off_t size() const override { return upstream->size(); }
+    std::string filename() const override { return upstream->filename(); }
+};
+
 /*
  * This contains information about an LWP.  In linux, since NPTL, this is
  * essentially a thread. Old style, userland threads may have a single LWP for
@@ -92,7 +170,17 @@ using PstackOptions = std::bitset<PstackOption::maxopt>;
 struct Lwp {
     int stopCount;
     timeval stoppedAt;
-    Lwp() : stopCount{0}, stoppedAt{0,0} {}
+    int pendingSignal; // signal intercepted while stopping: delivered on resume.
+    bool attached; // we're tracing the LWP...
+    bool stopped; // ... and it has stopped.
+    intmax_t stopLatency; // microseconds from asking the LWP to stop until it did.
+    // Registers, read once when the LWP stops.
+    bool regsValid;
+    bool fpregsValid;
+    Elf::CoreRegisters regs;
+    Elf::CoreFPRegisters fpregs;
+    Lwp() : stopCount{0}, stoppedAt{0,0}, pendingSignal{0}, attached{false},
+        stopped{false}, stopLatency{0}, regsValid{false}, fpregsValid{false} {}
 };
 
 typedef std::vector<std::pair<std::string, std::string>> PathReplacementList;
@@ -112,6 +200,7 @@ protected:
 
 public:
     Elf::Addr sysent; // for AT_SYSINFO
+    PstackOptions options; // as passed to load()
     std::map<pid_t, Lwp> lwps;
     Dwarf::ImageCache &imageCache;
 
@@ -125,6 +214,9 @@ public:
     Reader::csptr io;
 
     virtual bool getRegs(lwpid_t pid, Elf::CoreRegisters *reg) = 0;
+    virtual bool getFPRegs(lwpid_t, Elf::CoreFPRegisters *) { return false; }
+    // End of the memory mapping containing "addr", or 0 if unknown.
+    virtual Elf::Addr mappingEnd(Elf::Addr) { return 0; }
     void addElfObject(Elf::Object::sptr obj, Elf::Addr load);
     Elf::Object::sptr findObject(Elf::Addr addr, Elf::Off *reloc) const;
     Dwarf::Info::sptr getDwarf(Elf::Object::sptr);
@@ -136,7 +228,10 @@ public:
     virtual void resumeProcess() = 0;
     virtual void resume(pid_t lwpid) = 0;
     std::ostream &dumpStackText(std::ostream &, const ThreadStack &, const PstackOptions &);
+    std::ostream &dumpFramesText(std::ostream &, const ThreadStack &, const PstackOptions &);
     std::ostream &dumpStackJSON(std::ostream &, const ThreadStack &);
+    std::string frameFunction(const Dwarf::StackFrame *); // name of the frame's function.
+    std::string frameArgs(Dwarf::StackFrame *); // its arguments, as -a prints them.
     template <typename T> void listThreads(const T &);
     Elf::Addr findSymbolByName(const char *objName, const char *symbolName) const;
     virtual ~Process();
@@ -169,9 +264,25 @@ struct LiveThreadList;
 class LiveProcess : public Process {
     pid_t pid;
     friend class LiveReader;
+    // [start, end) of each mapping in /proc/<pid>/maps, read when first needed.
+    std::mutex mapsLock;
+    std::vector<std::pair<Elf::Addr, Elf::Addr>> maps;
+    bool mapsLoaded;
+    bool seize(lwpid_t, Lwp &);
+    void waitStops(std::set<lwpid_t> &pending, std::chrono::steady_clock::time_point deadline);
+    void fetchRegs(lwpid_t, Lwp &);
+    // LWPs this thread gave up waiting for, still seized with an interrupt
+    // pending.
+    static thread_local std::set<lwpid_t> stragglers;
 public:
+    static void releaseStragglers();
+    // How long to wait for each LWP to stop, and for the whole process.
+    std::chrono::milliseconds lwpStopTimeout;
+    std::chrono::milliseconds stopTimeout;
     LiveProcess(Elf::Object::sptr &, pid_t, const PathReplacementList &, Dwarf::ImageCache &);
     virtual bool getRegs(lwpid_t pid, Elf::CoreRegisters *reg) override;
+    bool getFPRegs(lwpid_t, Elf::CoreFPRegisters *) override;
+    Elf::Addr mappingEnd(Elf::Addr) override;
     virtual void stop(pid_t) override;
     virtual void resume(pid_t) override;
     void stopProcess() override;
@@ -196,9 +307,12 @@ public:
 class CoreProcess : public Process {
     Elf::Object::sptr coreImage;
     friend class CoreReader;
+    bool regsLoaded; // have we read the LWPs' registers from the notes yet?
 public:
     CoreProcess(Elf::Object::sptr exec, Elf::Object::sptr core, const PathReplacementList &, Dwarf::ImageCache &);
     virtual bool getRegs(lwpid_t pid, Elf::CoreRegisters *reg) override;
+    bool getFPRegs(lwpid_t, Elf::CoreFPRegisters *) override;
+    Elf::Addr mappingEnd(Elf::Addr) override;
     virtual void stop(lwpid_t) override;
     virtual void resume(lwpid_t) override;
     void stopProcess() override;
@@ -216,6 +330,16 @@ public:
     ~StopProcess() { proc->resumeProcess(); }
 };
 
+// RAII to read a process's memory from a snapshot.
+struct UseSnapshot {
+    Process *proc;
+    Reader::csptr saved;
+public:
+    UseSnapshot(Process *proc_, Reader::csptr snapshot)
+        : proc(proc_), saved(proc->io) { if (snapshot) proc->io = snapshot; }
+    ~UseSnapshot() { proc->io = saved; }
+};
+
 // RAII to stop a process.
 struct StopLWP {
     Process *proc;
@@ -6,7 +6,9 @@
 #include <limits>
 #include <vector>
 #include <list>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdio.h>
 #include <string>
@@ -14,6 +16,7 @@
 #include <unordered_map>
 
 std::string dirname(const std::string &);
+std::string basename(const std::string &);
 
 class Exception : public std::exception {
     mutable std::ostringstream str;
@@ -148,8 +151,11 @@ class CacheReader : public Reader {
         Page() {};
         void load(const Reader &r, off_t offset_);
     };
+    // The cache may be shared by threads: "lock" protects "pages" and
+    // "stringCache", but is not held while reading from upstream.
+    mutable std::mutex lock;
     mutable std::list<Page *> pages;
-    Page *getPage(off_t pageoff) const;
+    Page *findPage(off_t pageoff) const;
 public:
     virtual size_t read(off_t off, size_t count, char *ptr) const override;
     virtual void describe(std::ostream &os) const override {
@@ -159,6 +165,7 @@ public:
     }
     CacheReader(Reader::csptr upstream_);
     std::string readString(off_t off) const override;
+    void flush() const; // drop everything cached, as upstream has changed.
     ~CacheReader();
     off_t size() const override { return upstream->size(); }
     std::string filename() const override { return upstream->filename(); }
@@ -218,6 +225,15 @@ public:
 
 std::string linkResolve(std::string name);
 
+/*
+ * Call "work" for each index in [0, count), using up to "threads" threads.
+ * Each thread takes the next unclaimed index when it finishes one, and is
+ * passed its own number in [0, threads) so it can keep per-thread state. If
+ * any call throws, the first exception is rethrown once all threads finish.
+ */
+void parallelFor(size_t count, unsigned threads,
+      const std::function<void(size_t index, unsigned thread)> &work);
+
 template <typename T> T maybe(T val, T dflt) {
     return val ?  val : dflt;
 }
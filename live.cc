@@ -3,6 +3,7 @@
 
 #include <sys/ptrace.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <dirent.h>
 #include <err.h>
@@ -10,8 +11,11 @@
 #include <unistd.h>
 #include <wait.h>
 
+#include <algorithm>
 #include <climits>
+#include <fstream>
 #include <iostream>
+#include <thread>
 #include <utility>
 
 std::string
@@ -23,6 +27,14 @@ procname(pid_t pid, const std::string &base)
 LiveReader::LiveReader(pid_t pid, const std::string &base)
    : FileReader(procname(pid, base)) {}
 
+static intmax_t
+usecsSince(const timeval &then)
+{
+    timeval now;
+    gettimeofday(&now, nullptr);
+    return (now.tv_sec - then.tv_sec) * 1000000 + now.tv_usec - then.tv_usec;
+}
+
 LiveProcess::LiveProcess(Elf::Object::sptr &ex, pid_t pid_,
             const PathReplacementList &repls, Dwarf::ImageCache &imageCache)
     : Process(
@@ -30,6 +42,9 @@ LiveProcess::LiveProcess(Elf::Object::sptr &ex, pid_t pid_,
             std::make_shared<CacheReader>(std::make_shared<LiveReader>(pid_, "mem")),
             repls, imageCache)
     , pid(pid_)
+    , mapsLoaded(false)
+    , lwpStopTimeout(1000)
+    , stopTimeout(5000)
 {
     (void)ps_getpid(this);
 }
@@ -56,12 +71,57 @@ LiveProcess::getRegs(lwpid_t pid, Elf::CoreRegisters *reg)
 #endif
 #ifdef __linux__
     stop(pid);
-    bool rc = ptrace(PTRACE_GETREGS, pid, 0, reg) != -1;
+    auto &tcb = lwps[pid];
+    bool rc = tcb.regsValid;
+    if (rc)
+        *reg = tcb.regs;
     resume(pid);
     return rc;
 #endif
 }
 
+bool
+LiveProcess::getFPRegs(lwpid_t pid, Elf::CoreFPRegisters *reg)
+{
+#ifdef __linux__
+    stop(pid);
+    auto &tcb = lwps[pid];
+    bool rc = tcb.fpregsValid;
+    if (rc)
+        *reg = tcb.fpregs;
+    resume(pid);
+    return rc;
+#else
+    (void)pid;
+    (void)reg;
+    return false;
+#endif
+}
+
+/*
+ * Read the registers of an LWP as soon as it stops, so anyone that wants them
+ * later, (thread_db, the unwinder, argument printing) doesn't need more
+ * ptrace calls.
+ */
+void
+LiveProcess::fetchRegs(lwpid_t pid, Lwp &tcb)
+{
+#ifdef __linux__
+    iovec iov;
+    iov.iov_base = &tcb.regs;
+    iov.iov_len = sizeof tcb.regs;
+    tcb.regsValid = ptrace(PTRACE_GETREGSET, pid, (void *)NT_PRSTATUS, &iov) == 0;
+    if (!tcb.regsValid)
+        *debug << "failed to read registers for LWP " << pid << ": " << strerror(errno) << "\n";
+    iov.iov_base = &tcb.fpregs;
+    iov.iov_len = sizeof tcb.fpregs;
+    tcb.fpregsValid = ptrace(PTRACE_GETREGSET, pid, (void *)NT_FPREGSET, &iov) == 0;
+#else
+    (void)pid;
+    (void)tcb;
+#endif
+}
+
 void
 LiveProcess::resume(lwpid_t pid)
 {
@@ -69,17 +129,27 @@ LiveProcess::resume(lwpid_t pid)
     assert(tcb.stopCount != 0); // We can't resume an LWP that is not suspended.
     if (--tcb.stopCount != 0)
         return;
-    kill(pid, SIGCONT);
-    if (ptrace(PT_DETACH, pid, caddr_t(1), 0) != 0)
-        std::clog << "failed to detach from process " << pid << ": " << strerror(errno) << "\n";
-    if (verbose >= 1) {
-        timeval tv;
-        gettimeofday(&tv, nullptr);
-        intmax_t usecs = (tv.tv_sec - tcb.stoppedAt.tv_sec) * 1000000;
-        usecs += tv.tv_usec;
-        usecs -= tcb.stoppedAt.tv_usec;
-        *debug << "resumed LWP " << pid << ": was stopped for " << std::dec << usecs << " microseconds" << std::endl;
+    if (tcb.attached && !tcb.stopped) {
+        // It may have stopped since we gave up waiting for it.
+        std::set<lwpid_t> pending { pid };
+        waitStops(pending, std::chrono::steady_clock::now());
+    }
+    if (tcb.stopped) {
+        // Detaching a seized LWP just lets it continue: there's no SIGSTOP for
+        // us to undo, and a job control stop stays in effect.
+        if (ptrace(PTRACE_DETACH, pid, 0, (void *)intptr_t(tcb.pendingSignal)) != 0)
+            std::clog << "failed to detach from process " << pid << ": " << strerror(errno) << "\n";
+    } else if (tcb.attached) {
+        std::clog << "warning: LWP " << pid << " never stopped: it will be released when it does\n";
+        stragglers.insert(pid);
     }
+    tcb.pendingSignal = 0;
+    tcb.attached = tcb.stopped = false;
+    tcb.regsValid = tcb.fpregsValid = false;
+    if (verbose >= 1)
+        *debug << "resumed LWP " << pid << ": took " << std::dec << tcb.stopLatency
+            << " microseconds to stop, was stopped for " << usecsSince(tcb.stoppedAt)
+            << " microseconds" << std::endl;
 }
 
 void
@@ -89,16 +159,50 @@ LiveProcess::findLWPs()
     DIR *d = opendir(dirName.c_str());
     dirent *de;
     if (d != nullptr) {
+        std::set<lwpid_t> found;
         while ((de = readdir(d)) != nullptr) {
             char *p;
             lwpid_t pid = strtol(de->d_name, &p, 0);
-            if (*p == 0)
+            if (*p == 0) {
                 (void)lwps[pid];
+                found.insert(pid);
+            }
         }
         closedir(d);
+        // Forget LWPs that have exited, unless we're in the middle of using them.
+        for (auto it = lwps.begin(); it != lwps.end(); ) {
+            if (it->second.stopCount == 0 && found.find(it->first) == found.end())
+                it = lwps.erase(it);
+            else
+                ++it;
+        }
     }
 }
 
+Elf::Addr
+LiveProcess::mappingEnd(Elf::Addr addr)
+{
+    std::lock_guard<std::mutex> guard(mapsLock);
+    if (!mapsLoaded) {
+        mapsLoaded = true;
+        std::ifstream in(procname(pid, "maps"));
+        std::string line;
+        while (std::getline(in, line)) {
+            char *p;
+            Elf::Addr start = strtoull(line.c_str(), &p, 16);
+            if (*p != '-')
+                continue;
+            Elf::Addr end = strtoull(p + 1, 0, 16);
+            maps.emplace_back(start, end);
+        }
+    }
+    auto it = std::upper_bound(maps.begin(), maps.end(), addr,
+          [] (Elf::Addr a, const std::pair<Elf::Addr, Elf::Addr> &map) { return a < map.first; });
+    if (it == maps.begin() || (--it)->second <= addr)
+        return 0;
+    return it->second;
+}
+
 pid_t
 LiveProcess::getPID() const
 {
@@ -108,8 +212,41 @@ LiveProcess::getPID() const
 void
 LiveProcess::stopProcess()
 {
-    stop(pid); // suspend the main process itself first.
-    findLWPs();
+    releaseStragglers();
+    {
+        // Threads may have come and gone since we last looked.
+        std::lock_guard<std::mutex> guard(mapsLock);
+        maps.clear();
+        mapsLoaded = false;
+    }
+    // ... and the process has run since, so anything we cached is stale.
+    if (auto cache = std::dynamic_pointer_cast<const CacheReader>(io))
+        cache->flush();
+
+    /*
+     * Interrupt every LWP before waiting for any of them, so they all stop at
+     * about the same time. Threads may be created while we do this, so go
+     * around again until we find no new LWPs, or run out of time.
+     */
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + stopTimeout;
+    std::set<lwpid_t> seen;
+    while (now < deadline) {
+        findLWPs();
+        std::set<lwpid_t> pending;
+        for (auto &lwp : lwps) {
+            if (!seen.insert(lwp.first).second)
+                continue;
+            if (lwp.second.stopCount++ == 0 && seize(lwp.first, lwp.second))
+                pending.insert(lwp.first);
+        }
+        if (pending.empty())
+            break;
+        waitStops(pending, std::min(deadline, now + lwpStopTimeout));
+        for (auto lwp : pending)
+            std::clog << "warning: LWP " << lwp << " did not stop in time\n";
+        now = std::chrono::steady_clock::now();
+    }
 
     /*
      * suspend any threads that the thread-db knows about.
@@ -125,14 +262,21 @@ LiveProcess::stopProcess()
         }
     });
 
-    // Stop all LWPS.
-    int i = 0;
-    for (auto &lwp : lwps) {
-        stop(lwp.first);
-        i++;
+    if (verbose >= 1) {
+        size_t stopped = 0;
+        auto slowest = lwps.end();
+        for (auto it = lwps.begin(); it != lwps.end(); ++it) {
+            if (!it->second.stopped)
+                continue;
+            ++stopped;
+            if (slowest == lwps.end() || it->second.stopLatency > slowest->second.stopLatency)
+                slowest = it;
+        }
+        *debug << "stopped process " << pid << ": " << std::dec << stopped << " of " << lwps.size() << " LWPs";
+        if (slowest != lwps.end())
+            *debug << ", slowest was LWP " << slowest->first << " at " << slowest->second.stopLatency << " microseconds";
+        *debug << "\n";
     }
-    if (verbose >= 2)
-        *debug << "stopped process " << pid << "\n";
 }
 
 void
@@ -148,8 +292,6 @@ LiveProcess::resumeProcess()
 
     for (auto &lwp : lwps)
         resume(lwp.first);
-
-    resume(pid);
 }
 
 void
@@ -158,15 +300,121 @@ LiveProcess::stop(lwpid_t pid)
     auto &tcb = lwps[pid];
     if (tcb.stopCount++ != 0)
         return;
+    if (seize(pid, tcb)) {
+        std::set<lwpid_t> pending { pid };
+        waitStops(pending, std::chrono::steady_clock::now() + lwpStopTimeout);
+        if (!pending.empty())
+            std::clog << "warning: LWP " << pid << " did not stop in time\n";
+    }
+}
 
+/*
+ * Attach to an LWP and ask it to stop, without waiting for it to do so.
+ * Unlike PT_ATTACH, this doesn't send it a SIGSTOP.
+ */
+bool
+LiveProcess::seize(lwpid_t pid, Lwp &tcb)
+{
     gettimeofday(&tcb.stoppedAt, nullptr);
-    if (ptrace(PT_ATTACH, pid, 0, 0) != 0) {
+    // If we gave up waiting for it before, it's still attached, and our
+    // interrupt is still pending.
+    if (stragglers.erase(pid) != 0) {
+        tcb.attached = true;
+        return true;
+    }
+    if (ptrace(PTRACE_SEIZE, pid, 0, 0) != 0) {
         *debug << "failed to stop LWP " << pid << ": ptrace failed: " << strerror(errno) << "\n";
-        return;
+        return false;
+    }
+    tcb.attached = true;
+    if (ptrace(PTRACE_INTERRUPT, pid, 0, 0) != 0) {
+        *debug << "failed to stop LWP " << pid << ": interrupt failed: " << strerror(errno) << "\n";
+        return false;
     }
+    return true;
+}
 
+/*
+ * Collect a stop notification from an LWP we've seized, if there is one,
+ * returning true if it has stopped, or gone away.
+ */
+static bool
+collectStop(lwpid_t pid, Lwp &tcb)
+{
     int status;
-    pid_t waitedpid = waitpid(pid, &status, pid == this->pid ? 0 : __WCLONE);
-    if (waitedpid == -1)
-        *debug << "failed to stop LWP " << pid << ": wait failed: " << strerror(errno) << "\n";
+    pid_t waited = waitpid(pid, &status, __WALL | WNOHANG);
+    if (waited == 0)
+        return false;
+    if (waited == pid && WIFSTOPPED(status)) {
+        tcb.stopped = true;
+        tcb.stopLatency = usecsSince(tcb.stoppedAt);
+        // If a signal arrived before our interrupt, we see it being
+        // delivered: remember it, so we can deliver it on detach.
+        if (status >> 16 == 0)
+            tcb.pendingSignal = WSTOPSIG(status);
+    } else {
+        if (waited == -1)
+            *debug << "failed to stop LWP " << pid << ": wait failed: " << strerror(errno) << "\n";
+        tcb.attached = false; // it's gone.
+    }
+    return true;
+}
+
+/*
+ * Collect stop notifications from the LWPs in "pending", until they have all
+ * stopped, or the deadline passes. On return, "pending" holds those that
+ * haven't stopped. We wait for each LWP by ID, so we never collect a stop
+ * meant for another trace, and poll rather than block, so an LWP that won't
+ * stop (eg, in an uninterruptible sleep) can't hang us.
+ */
+void
+LiveProcess::waitStops(std::set<lwpid_t> &pending, std::chrono::steady_clock::time_point deadline)
+{
+    const auto maxDelay = std::chrono::microseconds(10000);
+    std::chrono::microseconds delay(10);
+    for (;;) {
+        for (auto it = pending.begin(); it != pending.end(); ) {
+            auto &tcb = lwps[*it];
+            if (!collectStop(*it, tcb)) {
+                ++it;
+                continue;
+            }
+            if (tcb.stopped)
+                fetchRegs(*it, tcb);
+            it = pending.erase(it);
+        }
+        if (pending.empty())
+            break;
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+            break;
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(delay, deadline - now));
+        delay = std::min(delay * 2, maxDelay);
+    }
+}
+
+thread_local std::set<lwpid_t> LiveProcess::stragglers;
+
+/*
+ * Detach from LWPs that have stopped since we gave up waiting for them.
+ * ptrace attaches an LWP to the thread that seized it, so only that thread
+ * can do this: any left when it exits are released by the kernel.
+ */
+void
+LiveProcess::releaseStragglers()
+{
+    for (auto it = stragglers.begin(); it != stragglers.end(); ) {
+        Lwp tcb;
+        if (!collectStop(*it, tcb)) {
+            ++it;
+            continue;
+        }
+        if (tcb.stopped) {
+            if (ptrace(PTRACE_DETACH, *it, 0, (void *)intptr_t(tcb.pendingSignal)) != 0)
+                std::clog << "failed to detach from process " << *it << ": " << strerror(errno) << "\n";
+            else if (verbose >= 1)
+                *debug << "released LWP " << *it << " after it stopped late\n";
+        }
+        it = stragglers.erase(it);
+    }
 }
@@ -147,10 +147,10 @@ ps_lsetxmmregs (struct ps_prochandle * /* unused */, lwpid_t /* unused */, const
 }
 #endif
 
-ps_err_e ps_lgetfpregs(struct ps_prochandle * /* unused */, lwpid_t /* unused */, prfpregset_t * /* unused */)
+ps_err_e ps_lgetfpregs(struct ps_prochandle *ph, lwpid_t pid, prfpregset_t *fpregs)
 {
-    abort();
-    return (PS_ERR);
+    auto p = static_cast<Process *>(ph);
+    return p->getFPRegs(pid, (Elf::CoreFPRegisters *)fpregs) ? PS_OK : PS_ERR;
 }
 
 ps_err_e ps_lgetregs(struct ps_prochandle *ph, lwpid_t pid, prgregset_t gregset)
@@ -1,7 +1,5 @@
 #include <features.h>
 
-#define REGMAP(a,b)
-#include "libpstack/dwarf/archreg.h"
 #include "libpstack/dwarf.h"
 #include "libpstack/proc.h"
 #include "libpstack/ps_callback.h"
@@ -10,11 +8,13 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <algorithm>
 #include <climits>
 
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <set>
 #include <sys/ucontext.h>
 
@@ -37,9 +37,14 @@ Process::Process(Elf::Object::sptr exec, Reader::csptr memory,
         entry = exec->getHeader().e_entry;
 }
 
+// libthread_db keeps a global list of its agents, without locking it.
+static std::mutex agentLock;
+
 void
-Process::load(const PstackOptions &options)
+Process::load(const PstackOptions &options_)
 {
+    options = options_;
+
     /*
      * Attach the executable and any shared libs.
      * The process is still running here, but unless its actively loading or
@@ -59,7 +64,10 @@ Process::load(const PstackOptions &options)
 
     if (!options[PstackOption::nothreaddb]) {
         td_err_e the;
-        the = td_ta_new(this, &agent);
+        {
+            std::lock_guard<std::mutex> guard(agentLock);
+            the = td_ta_new(this, &agent);
+        }
         if (the != TD_OK) {
             agent = nullptr;
             if (verbose > 0 && the != TD_NOLIBTHREAD)
@@ -153,10 +161,8 @@ operator << (std::ostream &os, const JSON<Dwarf::StackFrame *, Process *> &jt)
 
     JObject jo(os);
 
-    Elf::Addr objIp = 0;
     Elf::Object::sptr obj;
-    Elf::Sym sym;
-    std::string fileName;
+    const Dwarf::Symbolization *sym = nullptr;
     std::string symName = "unknown";
     if (frame->ip == proc->sysent) {
         symName = "(syscall)";
@@ -164,24 +170,27 @@ operator << (std::ostream &os, const JSON<Dwarf::StackFrame *, Process *> &jt)
         Elf::Off loadAddr = 0;
         obj = proc->findObject(frame->ip, &loadAddr);
         if (obj) {
-            fileName = stringify(*obj->io);
-            objIp = frame->ip - loadAddr;
-            obj->findSymbolByAddress(objIp, STT_FUNC, sym, symName);
+            sym = &proc->getDwarf(obj)->symbolize(frame->ip - loadAddr, true);
+            if (sym->haveSymbol)
+                symName = sym->symbol;
         }
     }
 
     jo.field("ip", frame->ip);
+    // How we unwound the frame is interesting only when it's not the CFI, or
+    // we were asked to avoid it.
+    if (proc->options[PstackOption::framepointer]
+          || frame->unwindMethod != Dwarf::UnwindMethod::DWARF)
+        jo.field("unwind", Dwarf::unwindMethodName(frame->unwindMethod));
     if (symName != "")
         jo.field("function", symName);
+    if (sym != nullptr && sym->demangled != "")
+        jo.field("demangled", sym->demangled);
 
-    if (obj) {
-        jo.field("off", objIp - sym.st_value)
-            .field("file", fileName);
-        const auto &di = proc->getDwarf(obj);
-        if (di) {
-            auto src = di->sourceFromAddr(objIp - 1);
-            jo.field("source", src);
-        }
+    if (sym != nullptr) {
+        jo.field("off", sym->symbolOffset)
+            .field("file", stringify(*obj->io))
+            .field("source", sym->source);
     }
     return os;
 }
@@ -189,10 +198,13 @@ operator << (std::ostream &os, const JSON<Dwarf::StackFrame *, Process *> &jt)
 std::ostream &
 operator << (std::ostream &os, const JSON<ThreadStack, Process *> &ts)
 {
-    return JObject(os)
-        .field("ti_tid", ts->info.ti_tid)
+    JObject jo(os);
+    jo.field("ti_tid", ts->info.ti_tid)
         .field("ti_type", ts->info.ti_type)
         .field("ti_stack", ts->stack, ts.context);
+    if (ts->error != "")
+        jo.field("error", ts->error);
+    return os;
 }
 
 struct ArgPrint {
@@ -252,6 +264,8 @@ operator << (std::ostream &os, const RemoteValue &rv)
                int16_t *int16;
                int32_t *int32;
                int64_t *int64;
+               float *flt;
+               double *dbl;
                void **voidp;
                char *cp;
             } u;
@@ -312,6 +326,20 @@ operator << (std::ostream &os, const RemoteValue &rv)
                     }
                     break;
 
+                case DW_ATE_float:
+                    switch (size) {
+                        case sizeof (float):
+                            os << *u.flt;
+                            break;
+                        case sizeof (double):
+                            os << *u.dbl;
+                            break;
+                        default:
+                            os << "<" << size << "-byte float>";
+                            break;
+                    }
+                    break;
+
                 default:
                     abort();
             }
@@ -359,7 +387,26 @@ operator << (std::ostream &os, const ArgPrint &ap)
                         addr = fbstack.eval(ap.p, attr, ap.frame, ap.frame->elfReloc);
                         os << "=";
                         if (fbstack.isReg) {
-                           os << std::hex << addr << std::dec << "{r" << fbstack.inReg << "}";
+                           // Show floating point values held in (vector) registers as such.
+                           auto base = type;
+                           while (base.tag() == DW_TAG_typedef || base.tag() == DW_TAG_const_type)
+                              base = DIE(base.attribute(DW_AT_type));
+                           auto encoding = base.attribute(DW_AT_encoding);
+                           auto size = base.tag() == DW_TAG_base_type && encoding.valid()
+                              && uintmax_t(encoding) == DW_ATE_float ?
+                              uintmax_t(base.attribute(DW_AT_byte_size)) : 0;
+                           if (size == sizeof (double)) {
+                              double d;
+                              memcpy(&d, &addr, sizeof d);
+                              os << d;
+                           } else if (size == sizeof (float)) {
+                              float f;
+                              memcpy(&f, &addr, sizeof f);
+                              os << f;
+                           } else {
+                              os << std::hex << addr << std::dec;
+                           }
+                           os << "{r" << fbstack.inReg << "}";
                         } else {
                            os << RemoteValue(ap.p, addr, type);
                         }
@@ -385,6 +432,18 @@ Process::dumpStackText(std::ostream &os, const ThreadStack &thread, const Pstack
     os << std::dec;
     os << "thread: " << (void *)thread.info.ti_tid << ", lwp: "
        << thread.info.ti_lid << ", type: " << thread.info.ti_type << "\n";
+    return dumpFramesText(os, thread, options);
+}
+
+/*
+ * Print a thread's frames, (or why it has none), without saying which thread
+ * it is: the stack may stand for a group of threads.
+ */
+std::ostream &
+Process::dumpFramesText(std::ostream &os, const ThreadStack &thread, const PstackOptions &options)
+{
+    if (thread.error != "")
+        os << thread.error << "\n";
     int frameNo = 0;
     for (auto frame : thread.stack) {
 
@@ -395,80 +454,44 @@ Process::dumpStackText(std::ostream &os, const ThreadStack &thread, const Pstack
             if (verbose > 0)
                 os << "/" << std::hex << std::setw(ELF_BITS/4) << std::setfill('0') << frame->cfa;
             os << " ";
+            if (options[PstackOption::framepointer])
+                os << "[" << Dwarf::unwindMethodName(frame->unwindMethod) << "] ";
         }
 
-        Elf::Sym sym;
-        std::string fileName = "unknown file";
-        std::string symName;
-
         Elf::Off loadAddr;
         auto obj = findObject(frame->ip, &loadAddr);
         if (obj) {
-            fileName = stringify(*obj->io);
-            Elf::Addr objIp = frame->ip - loadAddr;
-
             Dwarf::Info::sptr dwarf = getDwarf(obj);
-            std::list<Dwarf::Unit::sptr> units;
-            if (dwarf->hasRanges()) {
-                for (const auto &rangeset : dwarf->ranges()) {
-                    for (const auto range : rangeset.ranges) {
-                        if (objIp >= range.start && objIp <= range.start + range.length) {
-                            units.push_back(dwarf->getUnit(rangeset.debugInfoOffset));
-                            break;
-                        }
-                    }
-                }
-            } else {
-                // no ranges - try each dwarf unit in turn. (This seems to happen for single-unit exe's only, so it's no big loss)
-                units = dwarf->getUnits();
-            }
-
+            const auto &sym = dwarf->symbolize(frame->ip - loadAddr, !options[PstackOption::nosrc]);
             std::string sigmsg = frame->cie != nullptr && frame->cie->isSignalHandler ?  "[signal handler called]" : "";
-            Dwarf::Unit::sptr dwarfUnit;
-            for (const auto &u : units) {
-                // find the DIE for this function
-                for (const auto &it : u->topLevelDIEs()) {
-                    auto de = Dwarf::findEntryForFunc(objIp, it);
-                    if (de) {
-                        symName = de.name();
-                        if (symName == "") {
-                            obj->findSymbolByAddress(objIp, STT_FUNC, sym, symName);
-                            if (symName != "")
-                                symName += "%"; // mark the lack of a dwarf symbol.
-                            else if (sigmsg == "")
-                                symName = "<unknown>";
-                        }
-                        frame->function = de;
-                        frame->dwarf = dwarf; // hold on to 'de'
-                        os << "in " << symName << sigmsg;
-                        auto lowpc = de.attribute(Dwarf::DW_AT_low_pc);
-                        if (lowpc.valid())
-                            os << "+" << objIp - uintmax_t(lowpc);
-                        os << "(";
-                        if (options[PstackOption::doargs]) {
-                            os << ArgPrint(*this, frame);
-                        }
-                        os << ")";
-                        dwarfUnit = u;
-                        break;
-                    }
+            if (sym.function) {
+                std::string symName = sym.function.name();
+                if (symName == "") {
+                    if (sym.symbol != "")
+                        symName = sym.symbol + "%"; // mark the lack of a dwarf symbol.
+                    else if (sigmsg == "")
+                        symName = "<unknown>";
                 }
-                if (dwarfUnit)
-                    break;
-            }
-
-            if (!dwarfUnit) {
-                obj->findSymbolByAddress(objIp, STT_FUNC, sym, symName);
-                if (symName != "" || sigmsg != "")
-                    os << "in " << symName << sigmsg << "!+" << objIp - sym.st_value << "()";
+                frame->function = sym.function;
+                frame->dwarf = dwarf; // hold on to the function's DIE
+                os << "in " << symName << sigmsg;
+                if (sym.haveOffset)
+                    os << "+" << sym.offset;
+                os << "(";
+                if (options[PstackOption::doargs]) {
+                    os << ArgPrint(*this, frame);
+                }
+                os << ")";
+            } else {
+                if (sym.symbol != "" || sigmsg != "")
+                    os << "in " << sym.symbol << sigmsg << "!+" << sym.symbolOffset << "()";
                 else
                     os << "in <unknown>" << sigmsg << "()";
             }
 
-            os << " at " << fileName;
-            if (!options[PstackOption::nosrc] && dwarf) {
-                auto source = dwarf->sourceFromAddr(objIp - 1);
-                for (auto ent : source)
+            os << " at " << *obj->io;
+            if (!options[PstackOption::nosrc]) {
+                for (auto ent : sym.source)
                     os << " at " << ent.first << ":" << std::dec << ent.second;
             }
         } else {
@@ -479,6 +502,45 @@ Process::dumpStackText(std::ostream &os, const ThreadStack &thread, const Pstack
     return os;
 }
 
+/*
+ * The name of a frame's function, for summaries of stacks, where we don't
+ * want offsets or source locations: prefer the DWARF name, then the symbol.
+ */
+std::string
+Process::frameFunction(const Dwarf::StackFrame *frame)
+{
+    if (frame->cie != nullptr && frame->cie->isSignalHandler)
+        return "[signal handler called]";
+    Elf::Off loadAddr;
+    auto obj = findObject(frame->ip, &loadAddr);
+    if (!obj)
+        return "[unknown]";
+    const auto &sym = getDwarf(obj)->symbolize(frame->ip - loadAddr, false);
+    if (sym.function && sym.function.name() != "")
+        return sym.function.name();
+    if (sym.demangled != "")
+        return sym.demangled;
+    if (sym.symbol != "")
+        return sym.symbol;
+    return stringify("[", basename(obj->io->filename()), "]");
+}
+
+std::string
+Process::frameArgs(Dwarf::StackFrame *frame)
+{
+    Elf::Off loadAddr;
+    auto obj = findObject(frame->ip, &loadAddr);
+    if (!obj)
+        return "";
+    auto dwarf = getDwarf(obj);
+    const auto &sym = dwarf->symbolize(frame->ip - loadAddr, false);
+    if (!sym.function)
+        return "";
+    frame->function = sym.function;
+    frame->dwarf = dwarf;
+    return stringify(ArgPrint(*this, frame));
+}
+
 void
 Process::addElfObject(Elf::Object::sptr obj, Elf::Addr load)
 {
@@ -623,36 +685,197 @@ Process::findSymbolByName(const char *objName, const char *symbolName) const
 
 Process::~Process()
 {
+    std::lock_guard<std::mutex> guard(agentLock);
     td_ta_delete(agent);
 }
 
+SnapshotReader::SnapshotReader(Reader::csptr upstream_)
+    : upstream(std::move(upstream_))
+    , copied(0)
+    , misses(0)
+{
+}
+
+SnapshotReader::~SnapshotReader()
+{
+    if (verbose >= 2)
+        *debug << "snapshot of " << *upstream << ": copied " << copied
+            << " bytes in " << regions.size() << " regions, "
+            << misses << " reads missed\n";
+}
+
+/*
+ * Copy as much of [start, start + size) as we can read. Reading stops at
+ * the first page we can't read: for a stack, that's its upper end.
+ */
 void
-ThreadStack::unwind(Process &p, Elf::CoreRegisters &regs)
+SnapshotReader::capture(Elf::Addr start, size_t size)
+{
+    static const size_t pageSize = 4096;
+    if (regions.find(start) != regions.end())
+        return;
+    std::vector<char> data(size);
+    size_t got = 0;
+    while (got < size) {
+        size_t chunk = std::min(size - got, pageSize - (start + got) % pageSize);
+        size_t rc;
+        try {
+            rc = upstream->read(start + got, chunk, &data[got]);
+        }
+        catch (const std::exception &) {
+            break;
+        }
+        got += rc;
+        if (rc != chunk)
+            break;
+    }
+    if (got == 0)
+        return;
+    data.resize(got);
+    copied += got;
+    regions.emplace(start, std::move(data));
+}
+
+void
+SnapshotReader::captureStack(const Elf::CoreRegisters &regs, size_t size)
+{
+    Dwarf::StackFrame frame;
+    frame.setCoreRegs(regs);
+    capture(frame.getReg(SPREG), size);
+}
+
+size_t
+SnapshotReader::read(off_t off, size_t count, char *ptr) const
+{
+    size_t total = 0;
+    while (count != 0) {
+        // Find the region containing "off", or the next one after it.
+        auto next = regions.upper_bound(off);
+        if (next != regions.begin()) {
+            auto region = std::prev(next);
+            Elf::Off offInRegion = off - region->first;
+            if (offInRegion < region->second.size()) {
+                size_t chunk = std::min(count, region->second.size() - offInRegion);
+                memcpy(ptr, region->second.data() + offInRegion, chunk);
+                off += chunk;
+                ptr += chunk;
+                count -= chunk;
+                total += chunk;
+                continue;
+            }
+        }
+        // Not in the snapshot: read up to the next region from the process.
+        size_t chunk = count;
+        if (next != regions.end() && next->first - off < chunk)
+            chunk = next->first - off;
+        ++misses;
+        size_t rc = upstream->read(off, chunk, ptr);
+        total += rc;
+        if (rc != chunk)
+            break;
+        off += chunk;
+        ptr += chunk;
+        count -= chunk;
+    }
+    return total;
+}
+
+const size_t StackWindow::maxSize;
+const size_t StackWindow::defaultSize;
+
+StackWindow::StackWindow(Reader::csptr upstream_, Elf::Addr sp, Elf::Addr mappingEnd)
+    : upstream(std::move(upstream_))
+    , start(sp)
+{
+    size_t size = mappingEnd > sp ? std::min(mappingEnd - sp, maxSize) : defaultSize;
+    data.resize(size);
+    try {
+        data.resize(upstream->read(start, size, data.data()));
+    }
+    catch (const std::exception &) {
+        data.clear();
+    }
+    if (verbose >= 3)
+        *debug << "read " << data.size() << " bytes of stack at " << std::hex << sp << std::dec << "\n";
+}
+
+size_t
+StackWindow::read(off_t off, size_t count, char *ptr) const
+{
+    if (Elf::Addr(off) >= start && Elf::Addr(off) - start + count <= data.size()) {
+        memcpy(ptr, data.data() + (off - start), count);
+        return count;
+    }
+    return upstream->read(off, count, ptr);
+}
+
+Dwarf::StackFrame *
+FrameArena::alloc()
+{
+    if (used == blocks.size() * blockSize)
+        blocks.emplace_back(new Dwarf::StackFrame[blockSize]);
+    auto frame = &blocks[used / blockSize][used % blockSize];
+    ++used;
+    return frame;
+}
+
+void
+FrameArena::release(Dwarf::StackFrame *frame)
+{
+    assert(used != 0 && frame == &blocks[(used - 1) / blockSize][(used - 1) % blockSize]);
+    *frame = Dwarf::StackFrame();
+    --used;
+}
+
+void
+ThreadStack::unwind(Process &p, FrameArena &arena, Elf::CoreRegisters &regs,
+      const Elf::CoreFPRegisters *fpregs, const PstackOptions &options)
 {
     stack.clear();
+    Dwarf::StackFrame *frame = nullptr;
     try {
-        auto prevFrame = new Dwarf::StackFrame();
+        auto prevFrame = arena.alloc();
         auto startFrame = prevFrame;
 
         // Set up the first frame using the machine context registers
         prevFrame->setCoreRegs(regs);
+        if (fpregs != nullptr)
+            prevFrame->setCoreFPRegs(*fpregs);
         prevFrame->ip = prevFrame->getReg(IPREG); // use the IP address in current frame
 
-        Dwarf::StackFrame *frame;
-        for (size_t frameCount = 0; frameCount < gMaxFrames; frameCount++, prevFrame = frame) {
+        Elf::Addr sp = prevFrame->getReg(SPREG);
+        StackWindow stackMem(p.io, sp, p.mappingEnd(sp));
+
+        for (;; prevFrame = frame) {
             stack.push_back(prevFrame);
+            // Only take a frame from the arena if we'll keep it.
+            if (stack.size() >= gMaxFrames)
+                break;
+            frame = arena.alloc();
             try {
-               frame = prevFrame->unwind(p);
+               // The innermost frame, or one interrupted by a signal, may not
+               // have set up its frame pointer yet, so always use the CFI for
+               // those.
+               auto callee = stack.size() >= 2 ? stack[stack.size() - 2] : nullptr;
+               bool interrupted = prevFrame == startFrame
+                  || (callee != nullptr && callee->cie != nullptr && callee->cie->isSignalHandler);
+               if (options[PstackOption::framepointer] && !interrupted &&
+                     prevFrame->unwindFramePointer(p, stackMem, *frame))
+                   continue;
+               if (!prevFrame->unwind(p, stackMem, *frame)) {
+                   arena.release(frame);
+                   break;
+               }
             }
             catch (const std::exception &ex) {
 #if defined(__amd64__) || defined(__i386__) // Hail Mary stack unwinding if we can't use DWARF
                // If the first frame fails to unwind, it might be a crash calling an invalid address.
                // pop the instruction pointer off the stack, and try again.
                 if (prevFrame == startFrame) {
-                    frame = new Dwarf::StackFrame();
                     *frame = *prevFrame;
+                    frame->unwindMethod = Dwarf::UnwindMethod::HEURISTIC;
                     auto sp = prevFrame->getReg(SPREG);
-                    auto in = p.io->read(sp, sizeof frame->ip, (char *)&frame->ip);
+                    auto in = stackMem.read(sp, sizeof frame->ip, (char *)&frame->ip);
                     if (in == sizeof frame->ip) {
                         frame->setReg(SPREG, sp + sizeof frame->ip);
                         continue;
@@ -670,7 +893,7 @@ ThreadStack::unwind(Process &p, Elf::CoreRegisters &regs)
                         if (obj->findSymbolByName("__restore", symbol) && objip == symbol.st_value)
                             sigContextAddr = prevFrame->getReg(SPREG) + 4;
                         else if (obj->findSymbolByName("__restore_rt", symbol) && objip == symbol.st_value)
-                            sigContextAddr = p.io->readObj<Elf::Addr>(prevFrame->getReg(SPREG) + 8) + 20;
+                            sigContextAddr = stackMem.readObj<Elf::Addr>(prevFrame->getReg(SPREG) + 8) + 20;
                         else
                             throw;
                         // This mapping is based on DWARF regnos, and ucontext.h
@@ -694,9 +917,9 @@ ThreadStack::unwind(Process &p, Elf::CoreRegisters &regs)
                             { 13, REG_ES },
                             { 14, REG_FS }
                         };
-                        p.io->readObj(sigContextAddr, &regs);
-                        frame = new Dwarf::StackFrame();
+                        stackMem.readObj(sigContextAddr, &regs);
                         *frame = *prevFrame;
+                        frame->unwindMethod = Dwarf::UnwindMethod::HEURISTIC;
                         for (auto &reg : gregmap)
                             frame->setReg(reg.dwarf, regs[reg.greg]);
                         frame->ip = regs[REG_EIP];
@@ -707,11 +930,12 @@ ThreadStack::unwind(Process &p, Elf::CoreRegisters &regs)
 #endif
                   throw;
             }
-            if (!frame)
-                break;
         }
     }
     catch (const std::exception &ex) {
         std::clog << "warning: exception unwinding stack: " << ex.what() << std::endl;
+        // Give back the frame we were unwinding into.
+        if (frame != nullptr && !stack.empty() && frame != stack.back())
+            arena.release(frame);
     }
 }
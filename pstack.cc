@@ -5,45 +5,128 @@
 #include "libpstack/python.h"
 #endif
 
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 
 #include <sysexits.h>
 #include <unistd.h>
 
 #include <csignal>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 
 #define XSTR(a) #a
 #define STR(a) XSTR(a)
 
-static bool doJson = false;
+/*
+ * How to trace processes: from the command line, or from a request to the
+ * daemon.
+ */
+struct Settings {
+    PstackOptions options;
+    bool doJson = false;
+    bool groupStacks = false;
+    unsigned unwindThreads = std::thread::hardware_concurrency();
+    size_t snapshotSize = 0;
+    int lwpStopTimeout = 1000; // milliseconds
+    int stopTimeout = 5000;
+    double sampleRate = 0; // samples per second; 0 if we're not sampling.
+    size_t sampleCount = 100;
+    double sampleDuration = 0; // seconds, if given instead of the count.
+    bool python = false;
+
+    // The time between samples. A valid rate makes this at least a tick,
+    // and no more than the clock can represent.
+    std::chrono::steady_clock::duration sampleInterval() const {
+        using namespace std::chrono;
+        return duration_cast<steady_clock::duration>(duration<double>(1 / sampleRate));
+    }
+    bool sampleRateValid() const {
+        using namespace std::chrono;
+        if (sampleRate == 0)
+            return true;
+        return sampleRate > 0
+            && 1 / sampleRate < duration<double>(steady_clock::duration::max()).count()
+            && sampleInterval().count() > 0;
+    }
+};
 
 extern std::ostream & operator << (std::ostream &os, const JSON<ThreadStack, Process *> &jt);
+extern std::ostream & operator << (std::ostream &os, const JSON<Dwarf::StackFrame *, Process *> &jt);
 
 static int usage();
-std::ostream &
-pstack(Process &proc, std::ostream &os, const PstackOptions &options)
-{
-    // get its back trace.
+
+/*
+ * Describing frames decodes DWARF lazily, into caches that traces of different
+ * processes share, and that aren't safe to fill concurrently. So the daemon's
+ * requests take turns to describe their stacks, though they stop and unwind
+ * their processes concurrently.
+ */
+static std::mutex describeLock;
+
+/*
+ * The stacks of all a process's threads at one point in time. The frames are
+ * owned by "frames", and, if we unwound after resuming the process, read from
+ * "snapshot".
+ */
+struct Capture {
+    std::unique_ptr<FrameArena[]> frames;
     std::list<ThreadStack> threadStacks;
+    std::shared_ptr<SnapshotReader> snapshot;
+};
+
+static void
+capture(Process &proc, const Settings &settings, Capture &cap)
+{
+    struct ThreadRegs {
+        ThreadStack *stack;
+        Elf::CoreRegisters regs;
+        Elf::CoreFPRegisters fpregs;
+        bool haveFP;
+    };
+    cap.frames.reset(new FrameArena[std::max(settings.unwindThreads, 1U)]);
+    auto &threadStacks = cap.threadStacks;
+    std::vector<ThreadRegs> toUnwind;
     std::set<pid_t> tracedLwps;
+    auto unwindAll = [&] () {
+        parallelFor(toUnwind.size(), settings.unwindThreads, [&] (size_t i, unsigned worker) {
+            auto &thread = toUnwind[i];
+            thread.stack->unwind(proc, cap.frames[worker], thread.regs,
+                  thread.haveFP ? &thread.fpregs : nullptr, settings.options);
+        });
+    };
     {
         StopProcess here(&proc);
-        proc.listThreads([&proc, &threadStacks, &tracedLwps] (const td_thrhandle_t *thr) {
 
-            Elf::CoreRegisters regs;
+        // Collect the registers of each thread first, then unwind the
+        // threads in parallel, each worker using its own frame arena.
+        proc.listThreads([&proc, &threadStacks, &toUnwind, &tracedLwps] (const td_thrhandle_t *thr) {
+
+            ThreadRegs thread;
             td_err_e the;
 #ifdef __linux__
-            the = td_thr_getgregs(thr, (elf_greg_t *) &regs);
+            the = td_thr_getgregs(thr, (elf_greg_t *) &thread.regs);
 #else
-            the = td_thr_getgregs(thr, &regs);
+            the = td_thr_getgregs(thr, &thread.regs);
 #endif
             if (the == TD_OK) {
                 threadStacks.push_back(ThreadStack());
                 td_thr_get_info(thr, &threadStacks.back().info);
-                threadStacks.back().unwind(proc, regs);
+                thread.stack = &threadStacks.back();
+                thread.haveFP = proc.getFPRegs(thread.stack->info.ti_lid, &thread.fpregs);
+                toUnwind.push_back(thread);
                 tracedLwps.insert(threadStacks.back().info.ti_lid);
             }
 
@@ -53,43 +136,542 @@ pstack(Process &proc, std::ostream &os, const PstackOptions &options)
             if (tracedLwps.find(lwp.first) == tracedLwps.end()) {
                 threadStacks.push_back(ThreadStack());
                 threadStacks.back().info.ti_lid = lwp.first;
-                Elf::CoreRegisters regs;
-                proc.getRegs(lwp.first,  &regs);
-                threadStacks.back().unwind(proc, regs);
+                ThreadRegs thread;
+                thread.stack = &threadStacks.back();
+                if (proc.getRegs(lwp.first, &thread.regs)) {
+                    thread.haveFP = proc.getFPRegs(lwp.first, &thread.fpregs);
+                    toUnwind.push_back(thread);
+                } else
+                    threadStacks.back().error = "not stopped: no stack available";
             }
         }
+
+        if (settings.snapshotSize != 0) {
+            // Just copy the top of each stack: we unwind once we resume.
+            cap.snapshot = std::make_shared<SnapshotReader>(proc.io);
+            for (auto &thread : toUnwind)
+                cap.snapshot->captureStack(thread.regs, settings.snapshotSize);
+        } else {
+            unwindAll();
+        }
+    }
+    UseSnapshot useSnapshot(&proc, cap.snapshot);
+    if (cap.snapshot)
+        unwindAll();
+}
+
+/*
+ * Threads with identical stacks, (the same instruction pointers, or the same
+ * reason for having none), such as the idle workers of a thread pool.
+ */
+struct StackGroup {
+    const ThreadStack *stack; // the first of the group.
+    std::vector<lwpid_t> lwps;
+};
+
+std::ostream &
+operator << (std::ostream &os, const JSON<StackGroup, Process *> &jg)
+{
+    JObject jo(os);
+    jo.field("count", jg->lwps.size())
+        .field("lwps", jg->lwps)
+        .field("ti_stack", jg->stack->stack, jg.context);
+    if (jg->stack->error != "")
+        jo.field("error", jg->stack->error);
+    return os;
+}
+
+/*
+ * Group threads with the same stack. If we're going to print arguments, they
+ * must match too.
+ */
+static std::vector<StackGroup>
+groupThreads(Process &proc, const std::list<ThreadStack> &threadStacks, bool withArgs)
+{
+    struct Key {
+        std::vector<Elf::Addr> ips;
+        std::string error;
+        std::string args;
+        bool operator == (const Key &rhs) const {
+            return ips == rhs.ips && error == rhs.error && args == rhs.args;
+        }
+    };
+    struct KeyHash {
+        size_t operator() (const Key &key) const {
+            size_t hash = std::hash<std::string>()(key.error) ^ std::hash<std::string>()(key.args);
+            for (auto ip : key.ips)
+                hash = hash * 31 + std::hash<Elf::Addr>()(ip);
+            return hash;
+        }
+    };
+    std::unordered_map<Key, size_t, KeyHash> index;
+    std::vector<StackGroup> groups;
+    for (auto &thread : threadStacks) {
+        Key key;
+        for (auto frame : thread.stack) {
+            key.ips.push_back(frame->ip);
+            if (withArgs)
+                key.args += proc.frameArgs(frame) + "\n";
+        }
+        key.error = thread.error;
+        auto it = index.find(key);
+        if (it == index.end()) {
+            it = index.emplace(std::move(key), groups.size()).first;
+            groups.push_back(StackGroup{ &thread, {} });
+        }
+        groups[it->second].lwps.push_back(thread.info.ti_lid);
     }
+    // Largest groups first; otherwise, keep the order we found them in.
+    std::stable_sort(groups.begin(), groups.end(),
+          [] (const StackGroup &l, const StackGroup &r) { return l.lwps.size() > r.lwps.size(); });
+    return groups;
+}
+
+std::ostream &
+pstack(Process &proc, std::ostream &os, const Settings &settings)
+{
+    // get its back trace.
+    Capture cap;
+    capture(proc, settings, cap);
+    UseSnapshot useSnapshot(&proc, cap.snapshot);
+    std::lock_guard<std::mutex> guard(describeLock);
 
     /*
      * resume at this point - maybe a bit optimistic if a shared library gets
      * unloaded while we print stuff out, but worth the risk, normally.
      */
-    if (doJson) {
-        os << json(threadStacks, &proc);
+    if (settings.groupStacks) {
+        // JSON doesn't show arguments, so they can't tell groups apart.
+        auto groups = groupThreads(proc, cap.threadStacks,
+              settings.options[PstackOption::doargs] && !settings.doJson);
+        if (settings.doJson) {
+            os << json(groups, &proc);
+        } else {
+            os << "process: " << *proc.io << "\n";
+            for (auto &group : groups) {
+                os << std::dec << group.lwps.size() << (group.lwps.size() == 1 ? " thread" : " threads") << ", lwps:";
+                const char *sep = " ";
+                for (auto lwp : group.lwps) {
+                    os << sep << lwp;
+                    sep = ", ";
+                }
+                os << "\n";
+                proc.dumpFramesText(os, *group.stack, settings.options);
+                os << std::endl;
+            }
+        }
+    } else if (settings.doJson) {
+        os << json(cap.threadStacks, &proc);
     } else {
         os << "process: " << *proc.io << "\n";
-        for (auto &s : threadStacks) {
-            proc.dumpStackText(os, s, options);
+        for (auto &s : cap.threadStacks) {
+            proc.dumpStackText(os, s, settings.options);
             os << std::endl;
         }
     }
     return os;
 }
 
+/*
+ * A distinct call path seen while sampling, outermost function first, and the
+ * number of times we saw a thread in it.
+ */
+struct CallPath {
+    std::vector<std::string> functions;
+    size_t count;
+};
+
+std::ostream &
+operator << (std::ostream &os, const JSON<CallPath> &jp)
+{
+    return JObject(os)
+        .field("functions", jp->functions)
+        .field("count", jp->count);
+}
+
+/*
+ * Take "samples" captures of the process's stacks, the sample rate times a
+ * second, and show how often each call path was seen, either folded, one
+ * path per line, as flame graph tools expect, or as JSON.
+ */
+static void
+sample(Process &proc, std::ostream &os, const Settings &settings, size_t samples)
+{
+    using namespace std::chrono;
+    auto interval = settings.sampleInterval();
+    std::map<std::vector<std::string>, size_t> paths;
+    size_t taken = 0, missed = 0;
+    auto next = steady_clock::now();
+    while (taken < samples) {
+        std::this_thread::sleep_until(next);
+        Capture cap;
+        try {
+            capture(proc, settings, cap);
+        }
+        catch (const std::exception &ex) {
+            std::clog << "warning: stopped sampling: " << ex.what() << "\n";
+            break;
+        }
+        if (cap.threadStacks.empty())
+            break; // the process has gone.
+        UseSnapshot useSnapshot(&proc, cap.snapshot);
+        std::unique_lock<std::mutex> guard(describeLock);
+        for (auto &thread : cap.threadStacks) {
+            if (thread.stack.empty())
+                continue;
+            std::vector<std::string> path;
+            for (auto frame = thread.stack.rbegin(); frame != thread.stack.rend(); ++frame)
+                path.push_back(proc.frameFunction(*frame));
+            ++paths[path];
+        }
+        guard.unlock();
+        ++taken;
+
+        // If we've fallen behind, skip the samples we missed.
+        next += interval;
+        auto now = steady_clock::now();
+        if (next < now) {
+            auto behind = (now - next) / interval + 1;
+            missed += behind;
+            next += behind * interval;
+        }
+    }
+    if (verbose >= 1)
+        *debug << "took " << taken << " samples, missed " << missed << "\n";
+
+    if (settings.doJson) {
+        std::vector<CallPath> stacks;
+        for (auto &path : paths)
+            stacks.push_back(CallPath{ path.first, path.second });
+        std::sort(stacks.begin(), stacks.end(),
+              [] (const CallPath &l, const CallPath &r) { return l.count > r.count; });
+        JObject(os)
+            .field("samples", taken)
+            .field("interval_us", uintmax_t(duration_cast<microseconds>(interval).count()))
+            .field("stacks", stacks);
+        os << "\n";
+    } else {
+        for (auto &path : paths) {
+            const char *sep = "";
+            for (auto &function : path.first) {
+                os << sep << function;
+                sep = ";";
+            }
+            os << " " << path.second << "\n";
+        }
+    }
+}
+
+/*
+ * Apply an option that says how to trace processes: these are accepted both
+ * on the command line, and in requests to the daemon. Returns false for any
+ * other option.
+ */
+static bool
+setOption(int c, const char *arg, Settings &settings)
+{
+    switch (c) {
+    case 'a':
+        settings.options.set(PstackOption::doargs);
+        break;
+    case 'j':
+        settings.doJson = true;
+        break;
+    case 's':
+        settings.options.set(PstackOption::nosrc);
+        break;
+    case 'S':
+        settings.snapshotSize = strtoul(arg, 0, 0);
+        break;
+    case 'r':
+        settings.sampleRate = strtod(arg, 0);
+        break;
+    case 'c':
+        settings.sampleCount = strtoul(arg, 0, 0);
+        break;
+    case 'l':
+        settings.sampleDuration = strtod(arg, 0);
+        break;
+    case 't':
+        settings.options.set(PstackOption::nothreaddb);
+        break;
+    case 'F':
+        settings.options.set(PstackOption::framepointer);
+        break;
+    case 'G':
+        settings.groupStacks = true;
+        break;
+    case 'T':
+        settings.unwindThreads = atoi(arg);
+        break;
+    case 'w':
+        settings.lwpStopTimeout = atoi(arg);
+        break;
+    case 'W':
+        settings.stopTimeout = atoi(arg);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Only one thread can ptrace a process at a time, so concurrent requests to
+ * the daemon for the same process take turns.
+ */
+class TracingPid {
+    static std::mutex lock;
+    static std::condition_variable done;
+    static std::set<pid_t> pids;
+    pid_t pid;
+public:
+    explicit TracingPid(pid_t pid_) : pid(pid_) {
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [this] { return pids.find(pid) == pids.end(); });
+        pids.insert(pid);
+    }
+    ~TracingPid() {
+        std::lock_guard<std::mutex> guard(lock);
+        pids.erase(pid);
+        done.notify_all();
+    }
+    TracingPid(const TracingPid &) = delete;
+    TracingPid &operator = (const TracingPid &) = delete;
+};
+std::mutex TracingPid::lock;
+std::condition_variable TracingPid::done;
+std::set<pid_t> TracingPid::pids;
+
+/*
+ * Trace the process or core named by "target", writing its stacks to "os".
+ * If it's an executable, use it for the targets that follow.
+ */
+static void
+trace(const std::string &target, Elf::Object::sptr &exec, Dwarf::ImageCache &imageCache,
+      const Settings &settings, std::ostream &os)
+{
+    pid_t pid = atoi(target.c_str());
+    try {
+        auto doStack = [&settings, &os] (Process &proc, bool live) {
+            proc.load(settings.options);
+            if (settings.sampleRate != 0) {
+                size_t samples = settings.sampleDuration != 0
+                    ? std::max(1.0, settings.sampleDuration * settings.sampleRate)
+                    : settings.sampleCount;
+                // A core can't change: one sample is as good as many.
+                sample(proc, os, settings, live ? samples : 1);
+                return;
+            }
+#ifdef WITH_PYTHON
+            if (settings.python) {
+                std::lock_guard<std::mutex> guard(describeLock);
+                PythonPrinter printer(proc, os, settings.options);
+                printer.printStacks();
+            } else
+#endif
+                pstack(proc, os, settings);
+        };
+        if (pid == 0 || (kill(pid, 0) == -1 && errno == ESRCH)) {
+            // It's a file: should be ELF, treat core and exe differently
+            // Don't put cores in the cache
+            auto obj = std::make_shared<Elf::Object>(imageCache, loadFile(target));
+
+            if (obj->getHeader().e_type == ET_CORE) {
+                CoreProcess proc(exec, obj, PathReplacementList(), imageCache);
+                doStack(proc, false);
+            } else {
+                // Cache executables, so a daemon keeps them warm.
+                exec = imageCache.getImageForName(target);
+            }
+        } else {
+            // It's a PID.
+            TracingPid tracing(pid);
+            LiveProcess proc(exec, pid, PathReplacementList(), imageCache);
+            proc.lwpStopTimeout = std::chrono::milliseconds(settings.lwpStopTimeout);
+            proc.stopTimeout = std::chrono::milliseconds(settings.stopTimeout);
+            doStack(proc, true);
+        }
+    } catch (const std::exception &e) {
+        os << "failed to process " << target << ": " << e.what() << "\n";
+    }
+}
+
+/*
+ * getopt keeps its state in globals, so connections take turns to parse their
+ * requests.
+ */
+static std::mutex optionsLock;
+
+/*
+ * At most maxConnections connections are served at once: more wait in the
+ * listen queue. A client that stalls for ioTimeout, sending its request or
+ * reading the reply, is dropped.
+ */
+static const unsigned maxConnections = 16;
+static const int ioTimeout = 10; // seconds
+static std::mutex connectionsLock;
+static std::condition_variable connectionDone;
+static unsigned connections;
+
+/*
+ * Handle one connection to the daemon. The request is a line of options and
+ * targets, as on the command line. The reply is the output, and we close the
+ * connection when it's all sent.
+ */
+static void
+serveRequest(int fd, Dwarf::ImageCache &imageCache, size_t cacheLimit)
+{
+    std::string line;
+    char buf[1024];
+    while (line.find('\n') == std::string::npos && line.size() < 65536) {
+        auto rc = read(fd, buf, sizeof buf);
+        if (rc <= 0)
+            break;
+        line.append(buf, rc);
+    }
+    line = line.substr(0, line.find('\n'));
+
+    std::vector<std::string> args { "pstack" };
+    std::istringstream words(line);
+    for (std::string word; words >> word; )
+        args.push_back(word);
+    std::vector<char *> argv;
+    for (auto &arg : args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    std::ostringstream os;
+    Settings settings;
+    bool ok = true;
+    int targets;
+    {
+        std::lock_guard<std::mutex> guard(optionsLock);
+        int c;
+        optind = 0; // start afresh.
+        opterr = 0;
+        while ((c = getopt(int(args.size()), argv.data(), "+ac:FGjl:r:sS:tT:w:W:")) != -1)
+            ok = setOption(c, optarg, settings) && ok;
+        targets = optind;
+    }
+    if (!ok || !settings.sampleRateValid()) {
+        os << "bad request: " << line << "\n";
+    } else {
+        Elf::Object::sptr exec;
+        for (int i = targets; i < int(args.size()); ++i)
+            trace(argv[i], exec, imageCache, settings, os);
+    }
+    {
+        // Without a limit, this still drops the DWARF of objects that were
+        // only used by this request. Measuring the DWARF's memory mustn't
+        // race with another request decoding it.
+        std::lock_guard<std::mutex> guard(describeLock);
+        imageCache.trim(cacheLimit != 0 ? cacheLimit : std::numeric_limits<size_t>::max());
+    }
+
+    auto reply = os.str();
+    for (size_t off = 0; off < reply.size(); ) {
+        auto rc = send(fd, reply.data() + off, reply.size() - off, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        off += rc;
+    }
+    close(fd);
+
+    std::lock_guard<std::mutex> guard(connectionsLock);
+    --connections;
+    connectionDone.notify_one();
+}
+
+/*
+ * A client can make us ptrace anything we can, so only our own user, and
+ * root, may connect.
+ */
+static bool
+peerAllowed(int fd)
+{
+    uid_t uid;
+#ifdef __FreeBSD__
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) == -1)
+        return false;
+#else
+    ucred cred;
+    socklen_t len = sizeof cred;
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+        return false;
+    uid = cred.uid;
+#endif
+    return uid == geteuid() || uid == 0;
+}
+
+/*
+ * Serve requests on a Unix socket until we're killed, keeping the image and
+ * DWARF caches warm between them.
+ */
+static int
+serve(const char *path, Dwarf::ImageCache &imageCache, size_t cacheLimit)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr.sun_path)
+        throw (Exception() << "socket path too long: " << path);
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1)
+        throw (Exception() << "can't create socket: " << strerror(errno));
+    unlink(path);
+    // Create the socket with mode 0600.
+    auto oldMask = umask(0177);
+    int rc = bind(sock, (sockaddr *)&addr, sizeof addr);
+    umask(oldMask);
+    if (rc == -1)
+        throw (Exception() << "can't bind to " << path << ": " << strerror(errno));
+    if (listen(sock, 16) == -1)
+        throw (Exception() << "can't listen on " << path << ": " << strerror(errno));
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(connectionsLock);
+            connectionDone.wait(guard, [] { return connections < maxConnections; });
+        }
+        int fd = accept(sock, nullptr, nullptr);
+        if (fd == -1) {
+            if (errno == EINTR)
+                continue;
+            throw (Exception() << "accept failed: " << strerror(errno));
+        }
+        if (!peerAllowed(fd)) {
+            close(fd);
+            continue;
+        }
+        timeval timeout { ioTimeout, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+        {
+            std::lock_guard<std::mutex> guard(connectionsLock);
+            ++connections;
+        }
+        std::thread(serveRequest, fd, std::ref(imageCache), cacheLimit).detach();
+    }
+}
+
 int
 emain(int argc, char **argv)
 {
     int i, c;
-    pid_t pid;
-    std::string execFile;
     Elf::Object::sptr exec;
     Dwarf::ImageCache imageCache;
     int sleepTime = 0;
-    PstackOptions options;
-
-    bool python = false;
+    Settings settings;
+    const char *socketPath = nullptr;
+    size_t cacheLimit = 0;
 
-    while ((c = getopt(argc, argv, "b:d:D:hjsVvag:pt")) != -1) {
+    while ((c = getopt(argc, argv, "b:c:d:D:FGhjl:L:M:r:sS:Vvag:ptT:w:W:")) != -1) {
         switch (c) {
         case 'g':
             Elf::globalDebugDirectories.add(optarg);
@@ -108,77 +690,47 @@ emain(int argc, char **argv)
         case 'h':
             usage();
             return (0);
-        case 'a':
-            options.set(PstackOption::doargs);
-            break;
-        case 'j':
-            doJson = true;
-            break;
-        case 's':
-            options.set(PstackOption::nosrc);
-            break;
         case 'v':
             verbose++;
             break;
         case 'b':
             sleepTime = atoi(optarg);
             break;
+        case 'L':
+            socketPath = optarg;
+            break;
+        case 'M':
+            cacheLimit = strtoull(optarg, 0, 0) * 1024 * 1024;
+            break;
         case 'p':
 #ifdef WITH_PYTHON
-            python = true;
+            settings.python = true;
 #else
             std::clog << "no python support compiled in" << std::endl;
 #endif
             break;
-        case 't':
-            options.set(PstackOption::nothreaddb);
-            break;
-
         case 'V':
             std::clog << STR(VERSION) << "\n";
             return 0;
         default:
-            return usage();
+            if (!setOption(c, optarg, settings))
+                return usage();
+            break;
         }
     }
 
+    if (!settings.sampleRateValid())
+        return usage();
+    if (socketPath != nullptr)
+        return serve(socketPath, imageCache, cacheLimit);
     if (optind == argc)
         return usage();
 
     do {
-       for (i = optind; i < argc; i++) {
-           pid = atoi(argv[i]);
-           try {
-               auto doStack = [python, &options] (Process &proc) {
-                   proc.load(options);
-#ifdef WITH_PYTHON
-                   if (python) {
-                       PythonPrinter printer(proc, std::cout, options);
-                       printer.printStacks();
-                   } else
-#endif
-                       pstack(proc, std::cout, options);
-               };
-               if (pid == 0 || (kill(pid, 0) == -1 && errno == ESRCH)) {
-                   // It's a file: should be ELF, treat core and exe differently
-                   // Don't put cores in the cache
-                   auto obj = std::make_shared<Elf::Object>(imageCache, loadFile(argv[i]));
-
-                   if (obj->getHeader().e_type == ET_CORE) {
-                       CoreProcess proc(exec, obj, PathReplacementList(), imageCache);
-                       doStack(proc);
-                   } else {
-                       exec = obj;
-                   }
-               } else {
-                   // It's a PID.
-                   LiveProcess proc(exec, pid, PathReplacementList(), imageCache);
-                   doStack(proc);
-               }
-           } catch (const std::exception &e) {
-               std::cout << "failed to process " << argv[i] << ": " << e.what() << "\n";
-           }
-       }
+       for (i = optind; i < argc; i++)
+           trace(argv[i], exec, imageCache, settings, std::cout);
+       if (cacheLimit != 0)
+          imageCache.trim(cacheLimit);
        if (sleepTime != 0)
           sleep(sleepTime);
     } while (sleepTime != 0);
@@ -213,7 +765,18 @@ usage()
         "\t[-a]                         show arguments to functions where possible (TODO: not finished)\n"
         "\t[-n]                         don't try to find external debug images\n"
         "\t[-t]                         don't try to use the thread_db library\n"
+        "\t[-F]                         follow frame pointers where possible, rather than the CFI\n"
+        "\t[-G]                         print each distinct stack once, with the threads that share it\n"
         "\t[-b<n>]                      batch mode: repeat every 'n' seconds\n"
+        "\t[-r<hz>]                     sample stacks 'hz' times a second, and count call paths\n"
+        "\t[-c<n>]                      when sampling, take 'n' samples (default 100)\n"
+        "\t[-l<s>]                      when sampling, sample for 's' seconds\n"
+        "\t[-T<n>]                      unwind threads using up to 'n' threads\n"
+        "\t[-S<n>]                      copy 'n' bytes of each stack, and unwind after resuming\n"
+        "\t[-w<ms>]                     wait at most 'ms' milliseconds for each thread to stop\n"
+        "\t[-W<ms>]                     wait at most 'ms' milliseconds for the process to stop\n"
+        "\t[-L<path>]                   serve requests on the Unix socket 'path'\n"
+        "\t[-M<mb>]                     keep at most 'mb' megabytes of images cached\n"
         "\t[<pid>|<core>|<executable>]* list cores and pids to examine. An executable\n"
         "\t                             will override use of in-core or in-process information\n"
         "\t                             to predict location of the executable\n"
@@ -145,46 +145,73 @@ CacheReader::~CacheReader()
         delete i;
 }
 
+void
+CacheReader::flush() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto &i : pages)
+        delete i;
+    pages.clear();
+    stringCache.clear();
+}
+
+/*
+ * Find a cached page, and move it to the front of the list. Called with
+ * "lock" held.
+ */
 CacheReader::Page *
-CacheReader::getPage(off_t pageoff) const
+CacheReader::findPage(off_t pageoff) const
 {
-    Page *p;
-    bool first = true;
     for (auto i = pages.begin(); i != pages.end(); ++i) {
-        p = *i;
+        Page *p = *i;
         if (p->offset == pageoff) {
-            // move page to front.
-            if (!first) {
+            if (i != pages.begin()) {
                 pages.erase(i);
                 pages.push_front(p);
             }
             return p;
         }
-        first = false;
-    }
-    if (pages.size() == MAXPAGES) {
-        p = pages.back();
-        pages.pop_back();
-    } else {
-        p = new Page();
     }
-    p->load(*upstream, pageoff);
-    pages.push_front(p);
-    return p;
+    return nullptr;
 }
 
 size_t
 CacheReader::read(off_t off, size_t count, char *ptr) const
 {
+    // Large reads go straight to upstream: caching them would just evict
+    // everything else.
+    if (count >= MAXPAGES * PAGESIZE / 2)
+        return upstream->read(off, count, ptr);
+
     off_t startoff = off;
+    std::unique_ptr<Page> loaded;
     for (;;) {
         if (count == 0)
             break;
         size_t offsetOfDataInPage = off % PAGESIZE;
         off_t offsetOfPageInFile = off - offsetOfDataInPage;
-        Page *page = getPage(offsetOfPageInFile);
-        if (page == nullptr)
-            break;
+
+        std::unique_lock<std::mutex> guard(lock);
+        Page *page = findPage(offsetOfPageInFile);
+        if (page == nullptr) {
+            // Read the page without holding the lock, so other threads can
+            // use the cache meanwhile. If one of them loads the same page
+            // first, we use theirs.
+            guard.unlock();
+            if (!loaded)
+                loaded.reset(new Page());
+            loaded->load(*upstream, offsetOfPageInFile);
+            guard.lock();
+            page = findPage(offsetOfPageInFile);
+            if (page == nullptr) {
+                page = loaded.release();
+                pages.push_front(page);
+                if (pages.size() > MAXPAGES) {
+                    loaded.reset(pages.back());
+                    pages.pop_back();
+                }
+            }
+        }
         size_t chunk = std::min(page->len - offsetOfDataInPage, count);
         memcpy(ptr, page->data + offsetOfDataInPage, chunk);
         off += chunk;
@@ -199,9 +226,17 @@ CacheReader::read(off_t off, size_t count, char *ptr) const
 string
 CacheReader::readString(off_t off) const
 {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto entry = stringCache.find(off);
+        if (entry != stringCache.end())
+            return entry->second.value;
+    }
+    auto value = Reader::readString(off);
+    std::lock_guard<std::mutex> guard(lock);
     auto &entry = stringCache[off];
     if (entry.isNew) {
-        entry.value = Reader::readString(off);
+        entry.value = value;
         entry.isNew = false;
     }
     return entry.value;
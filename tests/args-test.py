@@ -0,0 +1,29 @@
+#!/usr/bin/python
+
+import os, subprocess, time
+
+def frame(output, function):
+    for line in output.decode().splitlines():
+        if " in %s+" % function in line:
+            return line
+    assert False
+
+# Without optimisation, the arguments are in the frame, found through the
+# function's frame base.
+os.system("tests/args")
+floats = frame(subprocess.check_output(["./pstack", "-a", "core"]), "floats")
+assert "d=2.5" in floats
+assert "f=1.25" in floats
+assert "i=1" in floats
+
+# Optimised, the floating point arguments are in SSE registers, as described
+# by DWARF 4 and DWARF 5 location lists.
+for prog in [ "tests/argsreg4", "tests/argsreg5" ]:
+    proc = subprocess.Popen([prog, "spin"])
+    try:
+        time.sleep(0.5)
+        floats = frame(subprocess.check_output(["./pstack", "-a", str(proc.pid)]), "floats")
+        assert "d=3.5{r17}" in floats
+        assert "f=2.25{r18}" in floats
+    finally:
+        proc.kill()
@@ -0,0 +1,22 @@
+#include <stdlib.h>
+
+volatile int spin;
+
+__attribute__((noinline)) double
+floats(double d, float f, int i)
+{
+    // With optimisation, "d" and "f" stay in SSE registers while we spin.
+    while (spin)
+        ;
+    if (i == 1)
+        abort();
+    return d * 2 + f + i;
+}
+
+int
+main(int argc, char *argv[])
+{
+    (void)argv;
+    spin = argc > 1;
+    return (int)floats(argc + 1.5, argc + 0.25f, argc);
+}
@@ -0,0 +1,90 @@
+#!/usr/bin/python
+
+import os, subprocess, json, socket, threading, time
+
+# Serve requests from a daemon, and check it answers several clients at once
+# with the same stacks as running pstack directly.
+os.system("tests/thread")
+path = "daemon-test.sock"
+daemon = subprocess.Popen(["./pstack", "-L", path, "-M", "64"])
+
+def request(line):
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.connect(path)
+    s.sendall((line + "\n").encode())
+    reply = b""
+    while True:
+        data = s.recv(65536)
+        if not data:
+            break
+        reply += data
+    s.close()
+    return reply.decode()
+
+try:
+    for i in range(50):
+        if os.path.exists(path):
+            break
+        time.sleep(0.1)
+
+    # only our own user may connect.
+    assert os.stat(path).st_mode & 0o777 == 0o600
+
+    direct = json.loads(subprocess.check_output(["./pstack", "-j", "core"]))
+
+    replies = []
+    clients = [ threading.Thread(target=lambda: replies.append(request("-j core")))
+            for i in range(4) ]
+    for client in clients:
+        client.start()
+    for client in clients:
+        client.join()
+    assert len(replies) == 4
+    for reply in replies:
+        assert json.loads(reply) == direct
+
+    # grouped: 10 identical threads, and main.
+    groups = json.loads(request("-j -G core"))
+    assert len(groups) == 2
+    assert groups[0]["count"] == 10
+
+    assert request("-x core").startswith("bad request")
+
+    # Live processes: two clients tracing the same one take turns, while
+    # another is traced alongside them.
+    targets = [ subprocess.Popen(["tests/snapshot"]) for i in range(2) ]
+    try:
+        time.sleep(0.5)
+        pids = [ str(target.pid) for target in targets ]
+        def functions(reply):
+            return sorted([ frame["function"] for frame in thread["ti_stack"] ]
+                    for thread in json.loads(reply))
+        expected = functions(subprocess.check_output(["./pstack", "-j", pids[0]]))
+        assert len(expected) == 5
+        live = {}
+        def client(i, pid):
+            live[i] = request("-j " + pid)
+        clients = [ threading.Thread(target=client, args=(i, pid))
+                for i, pid in enumerate([ pids[0], pids[0], pids[1], pids[1] ]) ]
+        for client in clients:
+            client.start()
+        for client in clients:
+            client.join()
+        assert len(live) == 4
+        for reply in live.values():
+            assert functions(reply) == expected
+
+        # Neither is left traced, or stopped.
+        for pid in pids:
+            for task in os.listdir("/proc/%s/task" % pid):
+                with open("/proc/%s/task/%s/status" % (pid, task)) as status:
+                    fields = dict(line.split(":", 1) for line in status)
+                assert fields["TracerPid"].strip() == "0"
+                assert fields["State"].split()[0] == "S"
+    finally:
+        for target in targets:
+            target.kill()
+            target.wait()
+finally:
+    daemon.kill()
+    os.unlink(path)
@@ -0,0 +1,32 @@
+#!/usr/bin/python
+
+import os, subprocess, json
+
+def stacks():
+    return json.loads(subprocess.check_output(["./pstack", "-j", "core"]))
+
+# "entry" and "main" are in different ranges of the unit: "main" is in
+# .text.startup, so finding its source needs the unit's rnglist.
+os.system("tests/thread5")
+threads = stacks()
+assert len(threads) == 11
+entryThreads = 0
+for thread in threads:
+    for frame in thread["ti_stack"]:
+        if frame['function'] in ('entry', 'main'):
+            assert frame['source'][0]['first'] == 'thread.cc'
+        if frame['function'] == 'entry':
+            entryThreads += 1
+            lineNo = frame['source'][0]['second']
+            assert lineNo >= 23 and lineNo <= 24
+assert entryThreads == 10
+
+os.system("tests/segv5")
+threads = stacks()
+assert len(threads) == 1
+functions = [ frame['function'] for frame in threads[0]["ti_stack"] ]
+for function in [ 'my_abort', 'sigsegv', 'g', 'f', 'main' ]:
+    assert function in functions
+for frame in threads[0]["ti_stack"]:
+    if frame['function'] in ('sigsegv', 'g', 'f', 'main'):
+        assert frame['source'][0]['first'] == 'segv.c'
@@ -0,0 +1,29 @@
+#include "libpstack/dwarf.h"
+
+#include <iostream>
+
+/*
+ * Look up names in an image's accelerator table: for each DIE found, print
+ * the name, its tag, and its low pc, if it has one.
+ */
+int
+main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::clog << "usage: findnames <image> <name>...\n";
+        return 1;
+    }
+    Dwarf::ImageCache imageCache;
+    auto dwarf = imageCache.getDwarf(argv[1]);
+    auto index = dwarf->nameIndex();
+    std::cout << "index: " << (dynamic_cast<const Dwarf::DebugNames *>(index) ? ".debug_names"
+          : dynamic_cast<const Dwarf::GdbIndex *>(index) ? ".gdb_index" : "none") << "\n";
+    for (int i = 2; i < argc; ++i) {
+        for (const auto &die : dwarf->findNames(argv[i])) {
+            auto lowpc = die.attribute(Dwarf::DW_AT_low_pc);
+            std::cout << die.name() << " " << int(die.tag()) << " " << std::hex
+                << (lowpc.valid() ? uintmax_t(lowpc) : 0) << std::dec << "\n";
+        }
+    }
+    return 0;
+}
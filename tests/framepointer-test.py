@@ -0,0 +1,21 @@
+#!/usr/bin/python
+
+import os, subprocess, json
+os.system("tests/segvfp")
+
+def stack(*args):
+    threads = json.loads(subprocess.check_output(["./pstack", "-j"] + list(args) + ["core"]))
+    assert len(threads) == 1
+    return threads[0]["ti_stack"]
+
+# Following frame pointers must find the same frames as the CFI, through
+# the C library's frames that have no frame pointer, and the signal
+# trampoline.
+dwarf = stack()
+framepointer = stack("-F")
+functions = [ frame["function"] for frame in dwarf ]
+assert [ frame["function"] for frame in framepointer ] == functions
+assert [ frame["ip"] for frame in framepointer ] == [ frame["ip"] for frame in dwarf ]
+for function in [ 'my_abort', 'sigsegv', 'g', 'f', 'main' ]:
+    assert function in functions
+assert any(frame["unwind"] == "frame pointer" for frame in framepointer)
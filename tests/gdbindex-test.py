@@ -0,0 +1,20 @@
+#!/usr/bin/python
+
+import os, subprocess, json
+os.system("tests/gdbindex")
+
+# The source for each "entry" frame comes from the unit .gdb_index finds.
+pstack = subprocess.Popen(["./pstack", "-v", "-v", "-j", "core"],
+        stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+out, err = pstack.communicate()
+assert "unit ranges in .gdb_index of" in err.decode()
+threads = json.loads(out)
+entryThreads = 0
+for thread in threads:
+    for frame in thread["ti_stack"]:
+        if frame['function'] == 'entry':
+            entryThreads += 1
+            assert frame['source'][0]['first'] == 'thread.cc'
+            lineNo = frame['source'][0]['second']
+            assert lineNo >= 23 and lineNo <= 24
+assert entryThreads == 10
@@ -0,0 +1,35 @@
+#!/usr/bin/python
+
+import os, re, subprocess, time
+
+# The groups of threads in pstack's -G text output: (count, text) pairs.
+def groups(output):
+    found = []
+    for group in output.decode().split("\n\n"):
+        match = re.search(r"^(\d+) threads?, lwps: ", group, re.MULTILINE)
+        if match:
+            found.append((int(match.group(1)), group))
+    return found
+
+# The thread core: 10 identical threads in one group, then main.
+os.system("tests/thread")
+found = groups(subprocess.check_output(["./pstack", "-G", "core"]))
+assert [ count for count, _ in found ] == [ 10, 1 ]
+assert "10 threads, lwps: " in found[0][1]
+assert " in entry" in found[0][1]
+
+# Four threads with the same stack, but two different arguments: with -a,
+# they're grouped by their arguments too.
+proc = subprocess.Popen(["tests/groups"])
+try:
+    time.sleep(0.5)
+    pid = str(proc.pid)
+    found = groups(subprocess.check_output(["./pstack", "-G", pid]))
+    assert [ count for count, _ in found ] == [ 4, 1 ]
+    found = groups(subprocess.check_output(["./pstack", "-G", "-a", pid]))
+    assert [ count for count, _ in found ] == [ 2, 2, 1 ]
+    assert "wait_in+" in found[0][1] and "(id=1)" in found[0][1]
+    assert "wait_in+" in found[1][1] and "(id=2)" in found[1][1]
+finally:
+    proc.kill()
+    proc.wait()
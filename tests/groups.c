@@ -0,0 +1,30 @@
+#include <pthread.h>
+#include <unistd.h>
+
+__attribute__((noinline)) static void
+wait_in(long id)
+{
+    (void)id;
+    for (;;)
+        pause();
+}
+
+static void *
+entry(void *arg)
+{
+    wait_in((long)arg);
+    return 0;
+}
+
+/*
+ * Four threads with the same stack: two waiting with id 1, and two with 2.
+ */
+int
+main()
+{
+    pthread_t tid;
+    for (long i = 0; i < 4; i++)
+        pthread_create(&tid, 0, entry, (void *)(i / 2 + 1));
+    for (;;)
+        pause();
+}
@@ -0,0 +1,19 @@
+#!/usr/bin/python
+
+import os, subprocess
+
+# Look up "entry" through each kind of accelerator table, and check we get
+# the DIE for the function, at the address of its ELF symbol.
+def check(image, table):
+    out = subprocess.check_output(["tests/findnames", image, "entry", "nothere"]).decode()
+    lines = out.splitlines()
+    assert lines[0] == "index: " + table
+    symbols = subprocess.check_output(["nm", image]).decode().splitlines()
+    addr = [ int(s.split()[0], 16) for s in symbols if s.endswith(" T entry") ][0]
+    found = [ l.split() for l in lines[1:] ]
+    assert found == [ [ "entry", str(0x2e), "%x" % addr ] ]
+
+check("tests/gdbindex", ".gdb_index")
+# llc builds this, from names.ll, if we have it.
+if os.path.exists("tests/names"):
+    check("tests/names", ".debug_names")
@@ -0,0 +1,28 @@
+source_filename = "names.c"
+target triple = "x86_64-pc-linux-gnu"
+
+define dso_local i32 @entry(i32 %x) !dbg !10 {
+  %r = add i32 %x, 1, !dbg !15
+  ret i32 %r, !dbg !15
+}
+
+define dso_local i32 @main() !dbg !16 {
+  %r = call i32 @entry(i32 1), !dbg !19
+  ret i32 %r, !dbg !19
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!2, !3}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "names.ll", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug)
+!1 = !DIFile(filename: "names.c", directory: "/tmp")
+!2 = !{i32 7, !"Dwarf Version", i32 5}
+!3 = !{i32 2, !"Debug Info Version", i32 3}
+!10 = distinct !DISubprogram(name: "entry", scope: !1, file: !1, line: 1, type: !11, scopeLine: 1, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition, unit: !0)
+!11 = !DISubroutineType(types: !12)
+!12 = !{!13, !13}
+!13 = !DIBasicType(name: "int", size: 32, encoding: DW_ATE_signed)
+!15 = !DILocation(line: 1, column: 20, scope: !10)
+!16 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 2, type: !17, scopeLine: 2, spFlags: DISPFlagDefinition, unit: !0)
+!17 = !DISubroutineType(types: !18)
+!18 = !{!13}
+!19 = !DILocation(line: 2, column: 21, scope: !16)
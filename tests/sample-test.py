@@ -0,0 +1,39 @@
+#!/usr/bin/python
+
+import os, subprocess, json, time
+
+# Sample a live process whose four threads, and main, all wait in pause.
+proc = subprocess.Popen(["tests/snapshot"])
+try:
+    time.sleep(0.5)
+    pid = str(proc.pid)
+
+    # Folded: one line per call path, outermost first, with its count.
+    out = subprocess.check_output(["./pstack", "-r", "20", "-c", "3", pid]).decode()
+    counts = {}
+    for line in out.splitlines():
+        path, count = line.rsplit(" ", 1)
+        counts[path] = int(count)
+    entry = [ path for path in counts if path.endswith(";entry;pause") ]
+    assert len(entry) == 1 and counts[entry[0]] == 4 * 3
+    main = [ path for path in counts if ";main;" in path ]
+    assert len(main) == 1 and counts[main[0]] == 3
+    assert sum(counts.values()) == 5 * 3
+
+    # A duration: a quarter of a second at 20 a second is 5 samples.
+    result = json.loads(subprocess.check_output(["./pstack", "-j", "-r", "20", "-l", "0.25", pid]))
+    assert result["samples"] == 5
+    assert result["interval_us"] == 50000
+    stacks = result["stacks"]
+    assert stacks[0]["functions"][-2:] == [ "entry", "pause" ]
+    assert stacks[0]["count"] == 4 * 5
+    assert sum(stack["count"] for stack in stacks) == 5 * 5
+finally:
+    proc.kill()
+    proc.wait()
+
+# A core can't change, so we take just one sample of it.
+os.system("tests/thread")
+result = json.loads(subprocess.check_output(["./pstack", "-j", "-r", "10", "-c", "5", "core"]))
+assert result["samples"] == 1
+assert [ stack["count"] for stack in result["stacks"] if "entry" in stack["functions"] ] == [ 10 ]
@@ -0,0 +1,28 @@
+#!/usr/bin/python
+
+import os, subprocess, json, time
+
+# Unwinding a live process from a snapshot of its stacks should find the
+# same frames as unwinding it while it's stopped, even when the snapshot is
+# too small to hold the whole stack.
+proc = subprocess.Popen(["tests/snapshot"])
+try:
+    for i in range(50):
+        if len(os.listdir("/proc/%d/task" % proc.pid)) == 5:
+            break
+        time.sleep(0.1)
+
+    def stacks(*args):
+        threads = json.loads(subprocess.check_output(["./pstack", "-j"] +
+            list(args) + [str(proc.pid)]))
+        return sorted([ frame["function"] for frame in thread["ti_stack"] ]
+                for thread in threads)
+
+    stopped = stacks()
+    assert len(stopped) == 5
+    assert sum(1 for functions in stopped if "entry" in functions) == 4
+    assert sum(1 for functions in stopped if "main" in functions) == 1
+    assert stacks("-S", "65536") == stopped
+    assert stacks("-S", "64") == stopped
+finally:
+    proc.kill()
@@ -0,0 +1,21 @@
+#include <pthread.h>
+#include <unistd.h>
+
+static void *
+entry(void *unused)
+{
+    (void)unused;
+    for (;;)
+        pause();
+    return 0;
+}
+
+int
+main()
+{
+    pthread_t tid;
+    for (int i = 0; i < 4; i++)
+        pthread_create(&tid, 0, entry, 0);
+    for (;;)
+        pause();
+}
@@ -0,0 +1,34 @@
+#!/usr/bin/python
+
+import os, subprocess, time
+
+# The main thread of tests/vfork can't stop until its child exits, three
+# seconds after it starts. Check we give up on it promptly, print the other
+# threads anyway, and release it when it does stop.
+proc = subprocess.Popen(["tests/vfork"], stdout=subprocess.PIPE)
+try:
+    pid = proc.stdout.readline().decode().strip()
+    time.sleep(0.5)
+
+    start = time.time()
+    out = subprocess.check_output(["./pstack", "-w", "200", "-W", "1000", pid]).decode()
+    assert time.time() - start < 2
+    threads = out.split("\n\n")
+    main = [ thread for thread in threads if "lwp: %s," % pid in thread ]
+    assert len(main) == 1 and "not stopped" in main[0]
+    assert len([ thread for thread in threads if " in entry" in thread ]) == 2
+
+    # Sample until well after the child exits: once released, the main
+    # thread stops for later samples.
+    out = subprocess.check_output(["./pstack", "-w", "200", "-r", "2", "-c", "10", pid]).decode()
+    assert any(line.startswith("_start;") and ";main;pause " in line for line in out.splitlines())
+
+    # Nothing is left traced, or stopped.
+    for task in os.listdir("/proc/%s/task" % pid):
+        with open("/proc/%s/task/%s/status" % (pid, task)) as status:
+            fields = dict(line.split(":", 1) for line in status)
+        assert fields["TracerPid"].strip() == "0"
+        assert fields["State"].split()[0] == "S"
+finally:
+    proc.kill()
+    proc.wait()
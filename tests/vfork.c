@@ -0,0 +1,37 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static void *
+entry(void *unused)
+{
+    (void)unused;
+    for (;;)
+        pause();
+    return 0;
+}
+
+/*
+ * Block the main thread in vfork, where it can't be stopped until the child
+ * exits, a few seconds later, while the other threads wait in pause.
+ */
+int
+main()
+{
+    pthread_t tid;
+    for (int i = 0; i < 2; i++)
+        pthread_create(&tid, 0, entry, 0);
+    printf("%d\n", getpid());
+    fflush(stdout);
+    pid_t child = vfork();
+    if (child == 0) {
+        struct timespec delay = { 3, 0 };
+        nanosleep(&delay, 0);
+        _exit(0);
+    }
+    waitpid(child, 0, 0);
+    for (;;)
+        pause();
+}
@@ -1,5 +1,7 @@
 #include "libpstack/util.h"
+#include <atomic>
 #include <iostream>
+#include <thread>
 #include <sys/stat.h>
 
 std::string
@@ -10,3 +12,48 @@ dirname(const std::string &in)
         return ".";
     return in.substr(0, it);
 }
+
+std::string
+basename(const std::string &in)
+{
+    auto it = in.rfind('/');
+    return it == std::string::npos ? in : in.substr(it + 1);
+}
+
+void
+parallelFor(size_t count, unsigned threads,
+      const std::function<void(size_t, unsigned)> &work)
+{
+    if (threads > count)
+        threads = count;
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i)
+            work(i, 0);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::mutex errorLock;
+    std::exception_ptr error;
+    auto worker = [&] (unsigned thread) {
+        for (size_t i; (i = next++) < count; ) {
+            try {
+                work(i, thread);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(errorLock);
+                if (!error)
+                    error = std::current_exception();
+                next = count; // stop other threads taking more work.
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i)
+        pool.emplace_back(worker, i);
+    worker(0);
+    for (auto &t : pool)
+        t.join();
+    if (error)
+        std::rethrow_exception(error);
+}